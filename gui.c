@@ -8,16 +8,26 @@
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include "vu.h"
+#include "metrics.h"
 
 #ifndef  MAX_CHANNELS
-#define  MAX_CHANNELS  32
+#define  MAX_CHANNELS  128
 #endif
 
 #ifndef  MAX_RATE
 #define  MAX_RATE      250000
 #endif
 
+#ifndef  MAX_GROUPS
+#define  MAX_GROUPS    32
+#endif
+
+#ifndef  MAX_PAIRS
+#define  MAX_PAIRS     8
+#endif
+
 static volatile sig_atomic_t  done = 0;
 
 static void handle_done(int signum)
@@ -54,6 +64,7 @@ enum placement {
 
 static const char      *server = NULL;
 static const char      *device = NULL;
+static const char      *metrics = NULL;
 static int              channels = 2;
 static int              rate = 48000;
 static int              updates = 60;
@@ -61,15 +72,58 @@ static int              bar_size = 4;
 static int              bar_space = 3;
 static int              display_monitor = -1;
 static enum placement   display_placement = PLACEMENT_RIGHT;
+static int              display_scope = 0;
+static int              display_groups = 0;     /* Nonzero to draw only the groups */
+static int              display_levels = 0;     /* Nonzero to mark session peak percentiles */
+static float            alert_seconds = 0.0f;   /* Nonzero to flag silent or stuck channels */
+
+static int              groups = 0;
+static struct vu_group  group[MAX_GROUPS];
+static int              meters = 0;             /* channels + groups */
+static int              bar_first = 0;          /* First meter drawn as a bar */
+static int              bars = 0;               /* Number of meters drawn as bars */
+
+static int              pairs = 0;
+static int              pair_left[MAX_PAIRS];
+static int              pair_right[MAX_PAIRS];
+static struct vu_phase  phase[MAX_PAIRS];
+static float            scope_xy[2 * VU_SCOPE_POINTS];
+static int              scope_count = 0;
+
+static int              audio_state  = VU_CONNECTING;
+static int              audio_lost   = 0;       /* Failure reported, and not connected since */
+static int              audio_lost_err = 0;     /* Reason last reported */
+static int              audio_ever   = 0;       /* Nonzero once connected */
 
 static float           *peak_line    = NULL;
 static float           *peak         = NULL;
 
+/* Set by the detector in the capture thread; read by tick(), which reports changes, and draw(). */
+#define  ALERT_SILENT  1
+#define  ALERT_DC      2
+static atomic_int       alert[MAX_CHANNELS];
+static _Atomic float    alert_value[MAX_CHANNELS];  /* Stuck value, set before ALERT_DC */
+static atomic_int       alert_news = 0;         /* Nonzero if any alert changed */
+static int              alert_shown[MAX_CHANNELS];  /* Alerts last reported by tick() */
+
+static float           *level_mark   = NULL;    /* level_mark[channels][LEVEL_MARKS] */
+static int              level_age    = 0;       /* Frames since level_mark was refreshed */
+
 static float            decay_line   = 0.99f;
 static float            decay        = 0.95f;
 static float            red_limit    = 0.891251f;   /* Amplitude within 1 dB of clipping */
 static float            green_limit  = 0.707946f;   /* Amplitude within 3 dB of clipping */
 
+#define  LEVEL_MARKS  4
+
+static const float      level_percent[LEVEL_MARKS] = { 10.0f, 50.0f, 95.0f, 99.0f };
+static const float      level_color[LEVEL_MARKS][3] = {
+    { 0.4f, 0.4f, 0.4f },   /* P10: noise floor */
+    { 0.0f, 0.8f, 1.0f },   /* P50 */
+    { 1.0f, 0.8f, 0.0f },   /* P95 */
+    { 1.0f, 0.0f, 1.0f },   /* P99 */
+};
+
 static struct tickmark  tickmarks[] = {
     { .amplitude = 0.891251f, .red = 1.0f, .green = 0.00f, .blue = 0.0f },   /*  1 dB */
     { .amplitude = 0.794328f, .red = 1.0f, .green = 1.00f, .blue = 0.0f },   /*  2 dB */
@@ -88,26 +142,82 @@ static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
 {
     (void)user_data; /* Silence unused parameter warning; generates no code */
 
+    const float *const  level = peak + bar_first;
+    const float *const  line = peak_line + bar_first;
+
     GdkRectangle  area;
     gtk_widget_get_clip(widget, &area);
 
+    /* A grey background means no audio: connecting, or waiting for the source to come back. */
     cairo_save(cr);
-    cairo_set_source_rgb(cr, 0.0,0.0,0.0);
+    if (audio_state == VU_CONNECTED)
+        cairo_set_source_rgb(cr, 0.0,0.0,0.0);
+    else
+        cairo_set_source_rgb(cr, 0.25,0.25,0.25);
     cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
     cairo_paint(cr);
 
-    for (int i = 0; i < channels; i++) {
-        if (peak[i] >= red_limit)
+    /* Goniometer takes a square off the far end of the strip; mid is up, side is across. */
+    if (display_scope) {
+        double  x0, y0, half;
+
+        if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
+            half = 0.5 * area.width;
+            area.height -= area.width;
+            x0 = area.x + half;
+            y0 = area.y + area.height + half;
+        } else {
+            half = 0.5 * area.height;
+            area.width -= area.height;
+            x0 = area.x + area.width + half;
+            y0 = area.y + half;
+        }
+
+        cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+        cairo_set_line_width(cr, 1.0);
+        cairo_move_to(cr, x0 - half, y0);
+        cairo_line_to(cr, x0 + half, y0);
+        cairo_move_to(cr, x0, y0 - half);
+        cairo_line_to(cr, x0, y0 + half);
+        cairo_stroke(cr);
+
+        /* One path for the whole cloud keeps this to a single fill. */
+        cairo_set_source_rgb(cr, 0.5, 1.0, 0.5);
+        for (int i = 0; i < scope_count; i++)
+            cairo_rectangle(cr, x0 + scope_xy[2*i] * (half - 1.0), y0 - scope_xy[2*i + 1] * (half - 1.0), 1.0, 1.0);
+        cairo_fill(cr);
+    }
+
+    /* Flagged channels get a tinted slot behind their bar: blue for silent, magenta for stuck. */
+    if (alert_seconds > 0.0f) {
+        for (int i = 0; i < bars && bar_first + i < channels; i++) {
+            const int  flags = atomic_load_explicit(&alert[bar_first + i], memory_order_relaxed);
+            if (!flags)
+                continue;
+            if (flags & ALERT_DC)
+                cairo_set_source_rgb(cr, 0.4, 0.0, 0.4);
+            else
+                cairo_set_source_rgb(cr, 0.0, 0.0, 0.5);
+            if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT)
+                cairo_rectangle(cr, area.x + bar_space + i * (bar_space + bar_size), area.y, bar_size, area.height);
+            else
+                cairo_rectangle(cr, area.x, area.y + bar_space + i * (bar_space + bar_size), area.width, bar_size);
+            cairo_fill(cr);
+        }
+    }
+
+    for (int i = 0; i < bars; i++) {
+        if (level[i] >= red_limit)
             cairo_set_source_rgb(cr, 1.0, 0.0, 0.0);
         else
-        if (peak[i] <= green_limit)
-            cairo_set_source_rgb(cr, 0.0, 0.5 + 0.5*peak[i]/green_limit, 0.0);
+        if (level[i] <= green_limit)
+            cairo_set_source_rgb(cr, 0.0, 0.5 + 0.5*level[i]/green_limit, 0.0);
         else {
-            const double c = (peak[i] - green_limit) / (red_limit - green_limit);
+            const double c = (level[i] - green_limit) / (red_limit - green_limit);
             cairo_set_source_rgb(cr, c, 1.0-c, 0.0);
         }
 
-        const double c = (peak[i] < 0.0f) ? 0.0 : (peak[i] < 1.0f) ? peak[i] : 1.0;
+        const double c = (level[i] < 0.0f) ? 0.0 : (level[i] < 1.0f) ? level[i] : 1.0;
 
         if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
             cairo_rectangle(cr, area.x + bar_space + i * (bar_space + bar_size),
@@ -123,6 +233,38 @@ static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
         }
     }
 
+    /* Correlation bars follow the channel bars; they grow from the centre, up/right for in phase. */
+    for (int p = 0; p < pairs; p++) {
+        const int     i = bars + p;
+        const double  c = (phase[p].correlation < -1.0f) ? -1.0 : (phase[p].correlation < 1.0f) ? phase[p].correlation : 1.0;
+
+        if (c >= 0.0)
+            cairo_set_source_rgb(cr, 0.0, 0.5 + 0.5*c, 0.0);
+        else
+            cairo_set_source_rgb(cr, 0.5 - 0.5*c, 0.0, 0.0);
+
+        if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
+            const double  mid = area.y + 0.5*area.height;
+            const double  len = 0.5*(area.height - 2*bar_space);
+            cairo_rectangle(cr, area.x + bar_space + i * (bar_space + bar_size), (c >= 0.0) ? mid - c*len : mid,
+                                bar_size, ((c >= 0.0) ? c : -c)*len);
+            cairo_fill(cr);
+            cairo_set_source_rgb(cr, 0.5, 0.5, 0.5);
+            cairo_rectangle(cr, area.x + bar_space + i * (bar_space + bar_size), mid - 0.5, bar_size, 1.0);
+            cairo_fill(cr);
+        } else
+        if (display_placement == PLACEMENT_TOP || display_placement == PLACEMENT_BOTTOM) {
+            const double  mid = area.x + 0.5*area.width;
+            const double  len = 0.5*(area.width - 2*bar_space);
+            cairo_rectangle(cr, (c >= 0.0) ? mid : mid + c*len, area.y + bar_space + i * (bar_space + bar_size),
+                                ((c >= 0.0) ? c : -c)*len, bar_size);
+            cairo_fill(cr);
+            cairo_set_source_rgb(cr, 0.5, 0.5, 0.5);
+            cairo_rectangle(cr, mid - 0.5, area.y + bar_space + i * (bar_space + bar_size), 1.0, bar_size);
+            cairo_fill(cr);
+        }
+    }
+
     cairo_set_line_width(cr, 1.0);
     if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
         for (int i = 0; tickmarks[i].amplitude >= 0.0f; i++) {
@@ -143,10 +285,32 @@ static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
         }
     }
 
+    /* Session peak percentiles, as marks across each real channel bar. */
+    if (display_levels) {
+        cairo_set_line_width(cr, 1.0);
+        for (int i = 0; i < bars && bar_first + i < channels; i++) {
+            for (int k = 0; k < LEVEL_MARKS; k++) {
+                const double  c = level_mark[(bar_first + i) * LEVEL_MARKS + k];
+                cairo_set_source_rgb(cr, level_color[k][0], level_color[k][1], level_color[k][2]);
+                if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
+                    const int  y = area.y + bar_space + (1.0 - c)*(area.height - 2*bar_space);
+                    cairo_move_to(cr, area.x + bar_space +  i   *(bar_space + bar_size), y + 0.5);
+                    cairo_line_to(cr, area.x + bar_space +  i   *(bar_space + bar_size) + bar_size, y + 0.5);
+                } else
+                if (display_placement == PLACEMENT_TOP || display_placement == PLACEMENT_BOTTOM) {
+                    const int  x = area.x + bar_space + c*(area.width - 2*bar_space);
+                    cairo_move_to(cr, x + 0.5, area.y + bar_space +  i   *(bar_space + bar_size));
+                    cairo_line_to(cr, x + 0.5, area.y + bar_space +  i   *(bar_space + bar_size) + bar_size);
+                }
+                cairo_stroke(cr);
+            }
+        }
+    }
+
     cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
     cairo_set_line_width(cr, 2.0);
-    for (int i = 0; i < channels; i++) {
-        const double c = (peak_line[i] < 0.0f) ? 0.0 : (peak_line[i] < 1.0f) ? peak_line[i] : 1.0;
+    for (int i = 0; i < bars; i++) {
+        const double c = (line[i] < 0.0f) ? 0.0 : (line[i] < 1.0f) ? line[i] : 1.0;
         if (display_placement == PLACEMENT_LEFT || display_placement == PLACEMENT_RIGHT) {
             const int  y = area.y + bar_space + (1.0f - c)*(area.height - 2*bar_space);
             cairo_move_to(cr, area.x +  i   *(bar_space + bar_size), y);
@@ -165,6 +329,59 @@ static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     return TRUE;
 }
 
+/* Runs in the capture thread: only flag the channel; tick() reports it, so stderr cannot stall capture. */
+static void detected(const struct vu_event *event, void *context)
+{
+    (void)context; /* Silence unused parameter warning; generates no code */
+
+    atomic_int *const  flags = alert + event->channel;
+
+    switch (event->type) {
+    case VU_EVENT_SILENT:
+        atomic_fetch_or_explicit(flags, ALERT_SILENT, memory_order_release);
+        break;
+    case VU_EVENT_SOUND:
+        atomic_fetch_and_explicit(flags, ~ALERT_SILENT, memory_order_release);
+        break;
+    case VU_EVENT_DC:
+        atomic_store_explicit(alert_value + event->channel, event->value, memory_order_relaxed);
+        atomic_fetch_or_explicit(flags, ALERT_DC, memory_order_release);
+        break;
+    case VU_EVENT_DC_CLEAR:
+        atomic_fetch_and_explicit(flags, ~ALERT_DC, memory_order_release);
+        break;
+    }
+    atomic_store_explicit(&alert_news, 1, memory_order_release);
+}
+
+/* Report alerts that changed since the last call; in the GTK thread. */
+static int report_alerts(void)
+{
+    if (!atomic_exchange_explicit(&alert_news, 0, memory_order_acquire))
+        return 0;
+
+    for (int c = 0; c < channels; c++) {
+        const int  now = atomic_load_explicit(alert + c, memory_order_acquire);
+        const int  changed = now ^ alert_shown[c];
+
+        if (changed & ALERT_SILENT) {
+            if (now & ALERT_SILENT)
+                fprintf(stderr, "Channel %d: silent for %.0f seconds.\n", c + 1, alert_seconds);
+            else
+                fprintf(stderr, "Channel %d: sound again.\n", c + 1);
+        }
+        if (changed & ALERT_DC) {
+            if (now & ALERT_DC)
+                fprintf(stderr, "Channel %d: stuck at %.3f for %.0f seconds.\n", c + 1,
+                        atomic_load_explicit(alert_value + c, memory_order_relaxed), alert_seconds);
+            else
+                fprintf(stderr, "Channel %d: no longer stuck.\n", c + 1);
+        }
+        alert_shown[c] = now;
+    }
+    return 1;
+}
+
 static gboolean tick(GtkWidget *widget, GdkFrameClock *fclk, gpointer user_data)
 {
     (void)user_data; /* Silence unused parameter warning; generates no code */
@@ -175,19 +392,63 @@ static gboolean tick(GtkWidget *widget, GdkFrameClock *fclk, gpointer user_data)
         return G_SOURCE_REMOVE;
     }
 
-    float  new_peak[channels];
-    if (vu_peak(new_peak, channels) == channels) {
-        for (int c = 0; c < channels; c++) {
+    int        err;
+    const int  state = vu_state(&err);
+    if (state != audio_state) {
+        /* Report the first failure, including at startup, and whenever the reason changes while retrying. */
+        if (state == VU_DISCONNECTED && (!audio_lost || err != audio_lost_err)) {
+            if (audio_state == VU_CONNECTED)
+                fprintf(stderr, "Audio source disconnected: %s.\n", vu_error(err));
+            else
+                fprintf(stderr, "Cannot connect to audio source: %s.\n", vu_error(err));
+            audio_lost = 1;
+            audio_lost_err = err;
+        } else
+        if (state == VU_CONNECTED && audio_lost) {
+            fprintf(stderr, "Audio source %s.\n", (audio_ever) ? "reconnected" : "connected");
+            audio_lost = 0;
+        }
+        if (state == VU_CONNECTED)
+            audio_ever = 1;
+        audio_state = state;
+        gtk_widget_queue_draw(widget);
+    }
+
+    if (report_alerts())
+        gtk_widget_queue_draw(widget);
+
+    float  new_peak[meters];
+    if (vu_peak(new_peak, meters) == meters) {
+        for (int c = 0; c < meters; c++) {
             peak[c] *= decay;
             peak[c]  = (new_peak[c] > peak[c]) ? new_peak[c] : peak[c];
 
             peak_line[c] *= decay_line;
             peak_line[c]  = (new_peak[c] > peak_line[c]) ? new_peak[c] : peak_line[c];
         }
+        if (pairs > 0)
+            vu_phase(phase, pairs);
+        if (display_scope)
+            scope_count = vu_scope(0, scope_xy, VU_SCOPE_POINTS);
+        /* Percentiles move slowly; a couple of refreshes per second is plenty. */
+        if (display_levels && ++level_age >= updates / 2) {
+            vu_percentiles(VU_LEVEL_PEAK, level_percent, LEVEL_MARKS, level_mark, channels);
+            level_age = 0;
+        }
+        gtk_widget_queue_draw(widget);
+    } else
+    if (audio_state != VU_CONNECTED) {
+        /* No data is coming; let the bars fall instead of freezing. */
+        for (int c = 0; c < meters; c++) {
+            peak[c] *= decay;
+            peak_line[c] *= decay_line;
+        }
+        for (int p = 0; p < pairs; p++)
+            phase[p].correlation = 0.0f;
+        scope_count = 0;
         gtk_widget_queue_draw(widget);
     }
 
-
     return G_SOURCE_CONTINUE;
 }
 
@@ -204,8 +465,8 @@ static void place(GdkRectangle *to, gulong *reserve)
 
     to->x = 0;
     to->y = 0;
-    to->width = bar_space + (bar_size + bar_space) * channels;
-    to->height = bar_space + (bar_size + bar_space) * channels;
+    to->width = bar_space + (bar_size + bar_space) * (bars + pairs);
+    to->height = bar_space + (bar_size + bar_space) * (bars + pairs);
 
     reserve[ 0] = 0;  /* left */
     reserve[ 1] = 0;  /* right */
@@ -358,11 +619,24 @@ int usage(const char *arg0)
     fprintf(stderr, "       -p WHERE     Meter placement on display\n");
     fprintf(stderr, "       -B PIXELS    Bar thickness in pixels\n");
     fprintf(stderr, "       -S PIXELS    Bar spacing in pixels\n");
+    fprintf(stderr, "       -P L,R       Show correlation of channels L and R (from 1)\n");
+    fprintf(stderr, "       -g           Show goniometer of the first pair\n");
+    fprintf(stderr, "       -G A-B[:HOW] Add a group of channels A to B (from 1)\n");
+    fprintf(stderr, "       -O           Show only the groups, not the channels\n");
+    fprintf(stderr, "       -H           Mark session peak percentiles P10/P50/P95/P99\n");
+    fprintf(stderr, "       -M ADDRESS   Serve Prometheus metrics locally\n");
+    fprintf(stderr, "       -A SECONDS   Flag channels silent or stuck for SECONDS\n");
     fprintf(stderr, "Placement:\n");
     fprintf(stderr, "       -p left      Left edge of monitor\n");
     fprintf(stderr, "       -p right     Right edge of monitor\n");
     fprintf(stderr, "       -p top       Top edge of monitor\n");
     fprintf(stderr, "       -p bottom    Bottom edge of monitor\n");
+    fprintf(stderr, "Metrics:\n");
+    fprintf(stderr, "       -M 9123      HTTP on 127.0.0.1 port 9123\n");
+    fprintf(stderr, "       -M /path     HTTP on a Unix socket (contains a '/')\n");
+    fprintf(stderr, "Group reductions:\n");
+    fprintf(stderr, "       -G A-B:max   Largest peak in the group (default)\n");
+    fprintf(stderr, "       -G A-B:power RMS level of the mean power of the group\n");
     fprintf(stderr, "\n");
     return EXIT_SUCCESS;
 }
@@ -380,7 +654,7 @@ int main(int argc, char *argv[])
 
     gtk_init(&argc, &argv);
 
-    while ((opt = getopt(argc, argv, "hs:d:c:r:u:m:p:B:S:")) != -1) {
+    while ((opt = getopt(argc, argv, "hs:d:c:r:u:m:p:B:S:P:gG:OHM:A:")) != -1) {
         switch (opt) {
 
         case 'h':
@@ -472,6 +746,92 @@ int main(int argc, char *argv[])
             bar_space = val;
             break;
 
+        case 'P':
+            if (pairs >= MAX_PAIRS) {
+                fprintf(stderr, "%s: Too many channel pairs.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != ',' || val < 1) {
+                fprintf(stderr, "%s: Invalid channel pair.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            pair_left[pairs] = val - 1;
+            p = skip_lws(parse_int(skip_lws(p + 1), &val));
+            if (!p || *p != '\0' || val < 1) {
+                fprintf(stderr, "%s: Invalid channel pair.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            pair_right[pairs] = val - 1;
+            pairs++;
+            break;
+
+        case 'g':
+            display_scope = 1;
+            break;
+
+        case 'G':
+            if (groups >= MAX_GROUPS) {
+                fprintf(stderr, "%s: Too many channel groups.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || val < 1) {
+                fprintf(stderr, "%s: Invalid channel group.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            group[groups].first = val - 1;
+            if (*p == '-') {
+                p = skip_lws(parse_int(skip_lws(p + 1), &val));
+                if (!p || val <= group[groups].first) {
+                    fprintf(stderr, "%s: Invalid channel group.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+            }
+            group[groups].count = val - group[groups].first;
+            group[groups].type = VU_GROUP_MAX;
+            if (*p == ':') {
+                if (!strcasecmp(p + 1, "max"))
+                    group[groups].type = VU_GROUP_MAX;
+                else
+                if (!strcasecmp(p + 1, "power"))
+                    group[groups].type = VU_GROUP_POWER;
+                else {
+                    fprintf(stderr, "%s: Unsupported group reduction.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+            } else
+            if (*p != '\0') {
+                fprintf(stderr, "%s: Invalid channel group.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            groups++;
+            break;
+
+        case 'O':
+            display_groups = 1;
+            break;
+
+        case 'H':
+            display_levels = 1;
+            break;
+
+        case 'M':
+            if (!optarg || optarg[0] == '\0')
+                metrics = NULL;
+            else
+                metrics = optarg;
+            break;
+
+        case 'A':
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != '\0' || val < 1) {
+                fprintf(stderr, "%s: Invalid number of seconds.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            alert_seconds = val;
+            break;
+
         case '?':
             /* getopt() has already printed an error message. */
             return EXIT_FAILURE;
@@ -507,6 +867,59 @@ int main(int argc, char *argv[])
     if (samples < 1)
         samples = 1;
 
+    for (int i = 0; i < pairs; i++) {
+        if (pair_left[i] >= channels || pair_right[i] >= channels) {
+            fprintf(stderr, "%d,%d: Channel pair outside the %d channels.\n", pair_left[i] + 1, pair_right[i] + 1, channels);
+            g_object_unref(app);
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < groups; i++) {
+        if (group[i].first + group[i].count > channels) {
+            fprintf(stderr, "%d-%d: Channel group outside the %d channels.\n", group[i].first + 1, group[i].first + group[i].count, channels);
+            g_object_unref(app);
+            return EXIT_FAILURE;
+        }
+    }
+    if (display_groups && groups < 1) {
+        fprintf(stderr, "Showing only groups needs at least one group (-G).\n");
+        g_object_unref(app);
+        return EXIT_FAILURE;
+    }
+
+    meters = channels + groups;
+    bar_first = (display_groups) ? channels : 0;
+    bars = meters - bar_first;
+
+    if (display_scope && pairs < 1) {
+        fprintf(stderr, "Goniometer needs a channel pair (-P).\n");
+        g_object_unref(app);
+        return EXIT_FAILURE;
+    }
+
+    val = vu_pairs(pair_left, pair_right, pairs);
+    if (val) {
+        fprintf(stderr, "Cannot measure channel pairs: %s.\n", vu_error(val));
+        g_object_unref(app);
+        return EXIT_FAILURE;
+    }
+
+    val = vu_groups(group, groups);
+    if (val) {
+        fprintf(stderr, "Cannot measure channel groups: %s.\n", vu_error(val));
+        g_object_unref(app);
+        return EXIT_FAILURE;
+    }
+
+    if (alert_seconds > 0.0f) {
+        val = vu_detect(detected, NULL, alert_seconds);
+        if (val) {
+            fprintf(stderr, "Cannot detect silent channels: %s.\n", vu_error(val));
+            g_object_unref(app);
+            return EXIT_FAILURE;
+        }
+    }
+
     val = vu_start(server, "vu-bar", device, "VU monitor", channels, rate, samples);
     if (val) {
         fprintf(stderr, "Cannot monitor audio source: %s.\n", vu_error(val));
@@ -514,17 +927,29 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    peak = calloc((size_t)channels * sizeof (float), samples);
-    peak_line = calloc((size_t)channels * sizeof (float), samples);
-    if (!peak) {
+    peak = calloc((size_t)meters, sizeof peak[0]);
+    peak_line = calloc((size_t)meters, sizeof peak_line[0]);
+    level_mark = calloc((size_t)channels * LEVEL_MARKS, sizeof level_mark[0]);
+    if (!peak || !peak_line || !level_mark) {
         fprintf(stderr, "Out of memory.\n");
         g_object_unref(app);
         vu_stop();
         return EXIT_FAILURE;
     }
 
+    if (metrics) {
+        val = metrics_start(metrics);
+        if (val) {
+            fprintf(stderr, "%s: Cannot serve metrics: %s.\n", metrics, vu_error(val));
+            g_object_unref(app);
+            vu_stop();
+            return EXIT_FAILURE;
+        }
+    }
+
     val = g_application_run(G_APPLICATION(app), 0, NULL);
     g_object_unref(app);
+    metrics_stop();
     vu_stop();
     return val;
 }
@@ -0,0 +1,411 @@
+#define  _POSIX_C_SOURCE  200809L
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include "vu.h"
+#include "metrics.h"
+
+#ifndef  METRICS_CHANNELS
+#define  METRICS_CHANNELS  128
+#endif
+
+/* Milliseconds a client gets to send its request, and to read the response, before it is dropped. */
+#ifndef  METRICS_TIMEOUT
+#define  METRICS_TIMEOUT   1000
+#endif
+
+static int              metrics_fd = -1;
+static int              metrics_wake[2] = { -1, -1 };
+static char            *metrics_path = NULL;    /* Unix socket path to remove, if any */
+static pthread_t        metrics_thread;
+
+static const char *const  state_name[] = { "stopped", "connecting", "connected", "disconnected" };
+
+/* Render all metrics into a newly allocated buffer. */
+static char *render(size_t *length)
+{
+    struct vu_stats  stats;
+    float            peak[METRICS_CHANNELS];
+    uint64_t         clipped[METRICS_CHANNELS];
+    char            *text = NULL;
+    FILE            *out;
+    int              channels;
+
+    channels = vu_stats(&stats, peak, clipped, METRICS_CHANNELS);
+    if (channels < 0)
+        return NULL;
+    if (channels > METRICS_CHANNELS)
+        channels = METRICS_CHANNELS;
+
+    out = open_memstream(&text, length);
+    if (!out)
+        return NULL;
+
+    fprintf(out, "# HELP vu_up Whether the audio source is being recorded.\n");
+    fprintf(out, "# TYPE vu_up gauge\n");
+    fprintf(out, "vu_up %d\n", (stats.state == VU_CONNECTED));
+
+    fprintf(out, "# HELP vu_state Connection state of the meter.\n");
+    fprintf(out, "# TYPE vu_state gauge\n");
+    for (int s = 0; s < 4; s++)
+        fprintf(out, "vu_state{state=\"%s\"} %d\n", state_name[s], (stats.state == s));
+
+    fprintf(out, "# HELP vu_peak_amplitude Peak amplitude of the latest block, 0 to 1.\n");
+    fprintf(out, "# TYPE vu_peak_amplitude gauge\n");
+    for (int c = 0; c < channels; c++)
+        fprintf(out, "vu_peak_amplitude{channel=\"%d\"} %.6f\n", c, peak[c]);
+
+    fprintf(out, "# HELP vu_clipped_blocks_total Blocks whose peak reached full scale.\n");
+    fprintf(out, "# TYPE vu_clipped_blocks_total counter\n");
+    for (int c = 0; c < channels; c++)
+        fprintf(out, "vu_clipped_blocks_total{channel=\"%d\"} %" PRIu64 "\n", c, clipped[c]);
+
+    fprintf(out, "# HELP vu_blocks_total Blocks processed by the capture thread.\n");
+    fprintf(out, "# TYPE vu_blocks_total counter\n");
+    fprintf(out, "vu_blocks_total %" PRIu64 "\n", stats.blocks);
+
+    fprintf(out, "# HELP vu_block_seconds Time spent processing each block.\n");
+    fprintf(out, "# TYPE vu_block_seconds summary\n");
+    fprintf(out, "vu_block_seconds_sum %.9f\n", stats.block_nsec / 1e9);
+    fprintf(out, "vu_block_seconds_count %" PRIu64 "\n", stats.blocks);
+
+    fprintf(out, "# HELP vu_block_seconds_max Longest time spent processing a block.\n");
+    fprintf(out, "# TYPE vu_block_seconds_max gauge\n");
+    fprintf(out, "vu_block_seconds_max %.9f\n", stats.block_nsec_max / 1e9);
+
+    fprintf(out, "# HELP vu_dropped_frames_total Frames lost to holes in the stream.\n");
+    fprintf(out, "# TYPE vu_dropped_frames_total counter\n");
+    fprintf(out, "vu_dropped_frames_total %" PRIu64 "\n", stats.dropped);
+
+    fprintf(out, "# HELP vu_overruns_total Server-side record buffer overruns.\n");
+    fprintf(out, "# TYPE vu_overruns_total counter\n");
+    fprintf(out, "vu_overruns_total %" PRIu64 "\n", stats.overruns);
+
+    fprintf(out, "# HELP vu_connects_total Successful connections to the audio source.\n");
+    fprintf(out, "# TYPE vu_connects_total counter\n");
+    fprintf(out, "vu_connects_total %" PRIu64 "\n", stats.connects);
+
+    fprintf(out, "# HELP vu_reads_total Peak reads that returned new data.\n");
+    fprintf(out, "# TYPE vu_reads_total counter\n");
+    fprintf(out, "vu_reads_total %" PRIu64 "\n", stats.reads);
+
+    fprintf(out, "# HELP vu_reader_lag_blocks Blocks processed since the peaks were last read.\n");
+    fprintf(out, "# TYPE vu_reader_lag_blocks gauge\n");
+    fprintf(out, "vu_reader_lag_blocks %" PRIu64 "\n", stats.lag);
+
+    if (stats.rate > 0) {
+        fprintf(out, "# HELP vu_reader_lag_seconds Audio time processed since the peaks were last read.\n");
+        fprintf(out, "# TYPE vu_reader_lag_seconds gauge\n");
+        fprintf(out, "vu_reader_lag_seconds %.6f\n", (double)stats.lag * stats.samples / stats.rate);
+    }
+
+    if (fclose(out)) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+/* Deadline METRICS_TIMEOUT milliseconds from now. */
+static void deadline_set(struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += METRICS_TIMEOUT / 1000;
+    deadline->tv_nsec += (METRICS_TIMEOUT % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * Wait until fd is ready for events.  Returns nonzero if ready; zero if
+ * the deadline passed, the client failed, or metrics_stop() was called.
+*/
+static int await(int fd, short events, const struct timespec *deadline)
+{
+    while (1) {
+        struct pollfd    p[2] = { { .fd = fd, .events = events }, { .fd = metrics_wake[0], .events = POLLIN } };
+        struct timespec  now;
+        long             msec;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        msec = (long)(deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+        if (msec < 1)
+            return 0;
+
+        const int  r = poll(p, 2, (int)msec);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r < 1 || p[1].revents)
+            return 0;
+        return (p[0].revents & events) != 0;
+    }
+}
+
+/*
+ * Send all of data before the deadline, retrying after signals.
+ * MSG_NOSIGNAL turns a client that hung up into EPIPE instead of a
+ * SIGPIPE that would kill the whole program; the socket is nonblocking,
+ * so a client that stops reading cannot hold send() past the deadline.
+*/
+static int write_all(int fd, const char *data, size_t length, const struct timespec *deadline)
+{
+    while (length > 0) {
+        if (!await(fd, POLLOUT, deadline))
+            return -1;
+
+        const ssize_t  n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n > 0) {
+            data += n;
+            length -= (size_t)n;
+        } else
+        if (n == -1 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;  /* EPIPE, ECONNRESET: the client is gone. */
+    }
+    return 0;
+}
+
+static void serve(int fd)
+{
+    char             request[1024];
+    size_t           have = 0;
+    struct timespec  deadline;
+
+    /* Read the request head within one deadline; its content does not matter, any GET gets the metrics. */
+    deadline_set(&deadline);
+    while (have < sizeof request - 1) {
+        if (!await(fd, POLLIN, &deadline))
+            return;
+
+        const ssize_t  n = read(fd, request + have, sizeof request - 1 - have);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (n < 1)
+            return;
+        have += (size_t)n;
+        request[have] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+
+    /* The response gets its own time limit, so a client that stops reading cannot stall stopping. */
+    deadline_set(&deadline);
+
+    if (strncmp(request, "GET ", 4)) {
+        static const char  bad[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        write_all(fd, bad, sizeof bad - 1, &deadline);
+        return;
+    }
+
+    size_t      length = 0;
+    char *const body = render(&length);
+    if (!body) {
+        static const char  fail[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        write_all(fd, fail, sizeof fail - 1, &deadline);
+        return;
+    }
+
+    char  head[160];
+    const int  n = snprintf(head, sizeof head, "HTTP/1.0 200 OK\r\n"
+                                               "Content-Type: text/plain; version=0.0.4\r\n"
+                                               "Content-Length: %zu\r\n"
+                                               "Connection: close\r\n\r\n", length);
+    if (!write_all(fd, head, (size_t)n, &deadline))
+        write_all(fd, body, length, &deadline);
+    free(body);
+}
+
+static void *worker(void *unused)
+{
+    (void)unused;  /* Silence warning about unused parameter. */
+
+    while (1) {
+        struct pollfd  p[2] = { { .fd = metrics_fd, .events = POLLIN }, { .fd = metrics_wake[0], .events = POLLIN } };
+
+        if (poll(p, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (p[1].revents)
+            break;
+        if (!(p[0].revents & POLLIN))
+            continue;
+
+        const int  fd = accept(metrics_fd, NULL, NULL);
+        if (fd == -1)
+            continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+            close(fd);
+            continue;
+        }
+        serve(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int listen_tcp(const char *port)
+{
+    struct sockaddr_in  addr;
+    char               *end;
+    long                val;
+    int                 fd, one = 1;
+
+    errno = 0;
+    val = strtol(port, &end, 10);
+    if (errno || end == port || *end != '\0' || val < 1 || val > 65535)
+        return -EINVAL;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)val);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -errno;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(fd, 8) == -1) {
+        const int  err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un  addr;
+    struct stat         info;
+    int                 fd;
+
+    if (strlen(path) >= sizeof addr.sun_path)
+        return -ENAMETOOLONG;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* A stale socket from an earlier run is in the way; anything else is not ours to remove. */
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -errno;
+
+    /*
+     * Create the socket 0600 from the start, so no other user can connect
+     * before the chmod().  The umask is process-wide; metrics_start() runs
+     * at startup, before other threads create files.
+    */
+    const mode_t  mask = umask(0177);
+    const int     bound = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+    const int     err = errno;
+    umask(mask);
+    if (bound == -1) {
+        close(fd);
+        return -err;
+    }
+    if (chmod(path, 0600) == -1 || listen(fd, 8) == -1) {
+        const int  err = errno;
+        close(fd);
+        unlink(path);
+        return -err;
+    }
+    return fd;
+}
+
+void metrics_stop(void)
+{
+    if (metrics_fd != -1) {
+        const char  c = 0;
+        if (write(metrics_wake[1], &c, 1) == 1)
+            pthread_join(metrics_thread, NULL);
+        close(metrics_fd);
+        metrics_fd = -1;
+    }
+
+    if (metrics_wake[0] != -1) {
+        close(metrics_wake[0]);
+        close(metrics_wake[1]);
+        metrics_wake[0] = -1;
+        metrics_wake[1] = -1;
+    }
+
+    if (metrics_path) {
+        unlink(metrics_path);
+        free(metrics_path);
+        metrics_path = NULL;
+    }
+}
+
+int metrics_start(const char *address)
+{
+    pthread_attr_t  attrs;
+    int             fd, err;
+
+    if (!address || !*address)
+        return -EINVAL;
+
+    /* If already running, stop. */
+    if (metrics_fd != -1)
+        metrics_stop();
+
+    if (strchr(address, '/')) {
+        metrics_path = strdup(address);
+        if (!metrics_path)
+            return -ENOMEM;
+        fd = listen_unix(address);
+    } else
+        fd = listen_tcp(address);
+    if (fd < 0) {
+        free(metrics_path);
+        metrics_path = NULL;
+        return fd;
+    }
+
+    if (pipe(metrics_wake) == -1) {
+        err = errno;
+        close(fd);
+        metrics_stop();
+        return -err;
+    }
+    fcntl(metrics_wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(metrics_wake[1], F_SETFD, FD_CLOEXEC);
+
+    /* render() keeps a few KiB of snapshot arrays on the stack. */
+    pthread_attr_init(&attrs);
+    pthread_attr_setstacksize(&attrs, 4 * PTHREAD_STACK_MIN);
+
+    metrics_fd = fd;
+    err = pthread_create(&metrics_thread, &attrs, worker, NULL);
+    pthread_attr_destroy(&attrs);
+    if (err) {
+        close(metrics_fd);
+        metrics_fd = -1;
+        metrics_stop();
+        return -err;
+    }
+
+    return 0;
+}
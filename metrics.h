@@ -0,0 +1,23 @@
+#ifndef   METRICS_H
+#define   METRICS_H
+
+/**
+ * Serve VU metrics in Prometheus text format from a separate thread
+ *
+ * Only local clients can connect: a TCP address is bound to the
+ * loopback interface, and a Unix socket is created mode 0600.
+ * The thread reads lock-free vu_stats() snapshots, so scraping
+ * never stalls the capture thread.
+ *
+ * @param address   TCP port number on 127.0.0.1, or a Unix socket
+ *                  path (containing a '/')
+ * @return          Zero if success, negative errno if error.
+*/
+int  metrics_start(const char *address);
+
+/**
+ * Stop serving metrics, removing the Unix socket if any
+*/
+void  metrics_stop(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,158 @@
+#ifndef   PEAK_H
+#define   PEAK_H
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * Block peaks at or above this count as clipped.  Positive full scale is
+ * below 1.0 for integer formats (0.99997 for 16-bit), so 1.0 would only
+ * ever catch negative full scale.
+*/
+#ifndef  PEAK_CLIP
+#define  PEAK_CLIP  0.999f
+#endif
+
+/**
+ * Channel pair sums accumulated by peak_block()
+ *
+ * Correlation is lr / sqrt(ll * rr); mid (L+R)/2 and side (L-R)/2
+ * energies follow from the same three sums.
+*/
+struct peak_pair {
+    size_t      left;       /* Left channel number */
+    size_t      right;      /* Right channel number */
+    double      ll;         /* Sum of left * left */
+    double      rr;         /* Sum of right * right */
+    double      lr;         /* Sum of left * right */
+};
+
+/**
+ * Compute per-channel peak amplitudes of one block
+ *
+ * This is the kernel shared by the live meter and offline analysis,
+ * so that both produce exactly the same per-block series.
+ *
+ * @param peak      Array of floats to be populated, 0 to 1
+ * @param min       Array of channels int32_ts to be populated with
+ *                  the smallest sample of each channel
+ * @param max       Array of channels int32_ts to be populated with
+ *                  the largest sample of each channel
+ * @param power     Array of channels doubles to be populated with
+ *                  sums of squared samples, or NULL
+ * @param pair      Channel pairs to sum in the same pass, or NULL
+ * @param pairs     Number of channel pairs
+ * @param data      Interleaved samples, data[samples][channels]
+ * @param channels  Number of channels
+ * @param samples   Samples per channel in the block
+*/
+static inline void peak_block(float *peak, int32_t *min, int32_t *max, double *power,
+                              struct peak_pair *pair, size_t pairs,
+                              const int32_t *data, size_t channels, size_t samples)
+{
+    for (size_t c = 0; c < channels; c++) {
+        min[c] = (int32_t)( 2147483647);
+        max[c] = (int32_t)(-2147483648);
+    }
+
+    if (power)
+        for (size_t c = 0; c < channels; c++)
+            power[c] = 0.0;
+
+    for (size_t p = 0; p < pairs; p++) {
+        pair[p].ll = 0.0;
+        pair[p].rr = 0.0;
+        pair[p].lr = 0.0;
+    }
+
+    const int32_t *const  end = data + channels * samples;
+    const int32_t        *ptr = data;
+
+    /* Min-max peak detect, and pair sums while the frame is in cache. */
+    while (ptr < end) {
+        for (size_t p = 0; p < pairs; p++) {
+            const double  l = ptr[pair[p].left];
+            const double  r = ptr[pair[p].right];
+            pair[p].ll += l * l;
+            pair[p].rr += r * r;
+            pair[p].lr += l * r;
+        }
+        if (power) {
+            for (size_t c = 0; c < channels; c++) {
+                const int32_t  s = *(ptr++);
+                min[c] = (min[c] < s) ? min[c] : s;
+                max[c] = (max[c] > s) ? max[c] : s;
+                power[c] += (double)s * (double)s;
+            }
+        } else {
+            for (size_t c = 0; c < channels; c++) {
+                const int32_t  s = *(ptr++);
+                min[c] = (min[c] < s) ? min[c] : s;
+                max[c] = (max[c] > s) ? max[c] : s;
+            }
+        }
+    }
+
+    /* Peak of the absolute values; min and max keep their signs for the caller. */
+    for (size_t c = 0; c < channels; c++) {
+        const int32_t  neg = (min[c] == (int32_t)(-2147483648)) ? (int32_t)(2147483647) :
+                             (min[c] < 0) ? -min[c] : 0;
+        const int32_t  pos = (max[c] > 0) ? max[c] : 0;
+
+        peak[c] = (pos > neg) ? pos / 2147483647.0f : neg / 2147483647.0f;
+    }
+}
+
+/* Independent accumulators per lane let the compiler use SIMD without -ffast-math. */
+#ifndef  PEAK_LANES
+#define  PEAK_LANES  8
+#endif
+
+/**
+ * Largest of count consecutive peak amplitudes
+*/
+static inline float peak_group_max(const float *peak, size_t count)
+{
+    float   acc[PEAK_LANES] = { 0.0f };
+    size_t  i = 0;
+
+    for (; i + PEAK_LANES <= count; i += PEAK_LANES)
+        for (size_t k = 0; k < PEAK_LANES; k++)
+            acc[k] = (acc[k] > peak[i + k]) ? acc[k] : peak[i + k];
+    for (; i < count; i++)
+        acc[0] = (acc[0] > peak[i]) ? acc[0] : peak[i];
+
+    for (size_t k = 1; k < PEAK_LANES; k++)
+        acc[0] = (acc[0] > acc[k]) ? acc[0] : acc[k];
+    return acc[0];
+}
+
+/**
+ * Mean power of count consecutive channels, as an RMS amplitude
+ *
+ * @param power     Sums of squared samples from peak_block()
+ * @param count     Number of channels
+ * @param scale     One over samples times full scale squared
+ * @return          0 to 1
+*/
+static inline float peak_group_power(const double *power, size_t count, double scale)
+{
+    double  acc[PEAK_LANES] = { 0.0 };
+    double  sum = 0.0;
+    size_t  i = 0;
+
+    if (count < 1)
+        return 0.0f;
+
+    for (; i + PEAK_LANES <= count; i += PEAK_LANES)
+        for (size_t k = 0; k < PEAK_LANES; k++)
+            acc[k] += power[i + k];
+    for (; i < count; i++)
+        sum += power[i];
+
+    for (size_t k = 0; k < PEAK_LANES; k++)
+        sum += acc[k];
+    return (float)sqrt(sum * scale / (double)count);
+}
+
+#endif /* PEAK_H */
@@ -0,0 +1,493 @@
+#define  _POSIX_C_SOURCE  200809L
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <locale.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+#include "peak.h"
+
+#ifndef  MAX_CHANNELS
+#define  MAX_CHANNELS  128
+#endif
+
+#ifndef  MAX_RATE
+#define  MAX_RATE      1000000
+#endif
+
+#ifndef  MAX_THREADS
+#define  MAX_THREADS   256
+#endif
+
+/* Target input bytes per work unit; large enough to amortize claiming, small enough to balance. */
+#ifndef  CHUNK_BYTES
+#define  CHUNK_BYTES   (4 << 20)
+#endif
+
+enum format {
+    FORMAT_S16LE = 1,
+    FORMAT_S24LE = 2,
+    FORMAT_S32LE = 3,
+    FORMAT_F32LE = 4
+};
+
+static const size_t     format_bytes[] = { 0, 2, 3, 4, 4 };
+
+static int              channels = 2;
+static int              rate = 48000;
+static int              updates = 60;
+static int              threads = 0;
+static enum format      format = FORMAT_S16LE;
+
+static const unsigned char *file_data = NULL;  /* First sample frame */
+static size_t           frame_bytes = 0;
+static size_t           samples = 0;            /* Samples per block per channel */
+static size_t           blocks = 0;             /* Complete blocks in file */
+static size_t           chunk_blocks = 0;       /* Blocks per work unit */
+static float           *result = NULL;          /* result[blocks][channels] */
+
+static pthread_mutex_t  chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t           chunk_next = 0;
+
+struct summary {
+    float              *peak;       /* Maximum block peak per channel */
+    size_t             *clipped;    /* Blocks reaching full scale per channel */
+    int                 err;
+};
+
+/* Convert one block of little-endian samples to the native S32 the kernel expects. */
+static void convert(int32_t *to, const unsigned char *from, size_t count)
+{
+    switch (format) {
+
+    case FORMAT_S16LE:
+        for (size_t i = 0; i < count; i++, from += 2)
+            to[i] = (int32_t)(((uint32_t)from[0] << 16) | ((uint32_t)from[1] << 24));
+        return;
+
+    case FORMAT_S24LE:
+        for (size_t i = 0; i < count; i++, from += 3)
+            to[i] = (int32_t)(((uint32_t)from[0] << 8) | ((uint32_t)from[1] << 16) | ((uint32_t)from[2] << 24));
+        return;
+
+    case FORMAT_S32LE:
+        for (size_t i = 0; i < count; i++, from += 4)
+            to[i] = (int32_t)((uint32_t)from[0] | ((uint32_t)from[1] << 8) | ((uint32_t)from[2] << 16) | ((uint32_t)from[3] << 24));
+        return;
+
+    case FORMAT_F32LE:
+        for (size_t i = 0; i < count; i++, from += 4) {
+            const uint32_t  u = (uint32_t)from[0] | ((uint32_t)from[1] << 8) | ((uint32_t)from[2] << 16) | ((uint32_t)from[3] << 24);
+            float           f;
+            memcpy(&f, &u, sizeof f);
+            if (f >= 1.0f)
+                to[i] = (int32_t)( 2147483647);
+            else
+            if (f <= -1.0f)
+                to[i] = (int32_t)(-2147483648);
+            else
+            if (f == f)
+                to[i] = (int32_t)(f * 2147483648.0);
+            else
+                to[i] = 0;  /* NaN */
+        }
+        return;
+    }
+}
+
+static void *worker(void *payload)
+{
+    struct summary *const  sum = payload;
+    const size_t           count = (size_t)channels * samples;
+    int32_t               *buffer = malloc(count * sizeof buffer[0]);
+    int32_t               *min = malloc((size_t)channels * sizeof min[0]);
+    int32_t               *max = malloc((size_t)channels * sizeof max[0]);
+
+    if (!buffer || !min || !max) {
+        free(max);
+        free(min);
+        free(buffer);
+        sum->err = ENOMEM;
+        return NULL;
+    }
+
+    while (1) {
+        size_t  b, bend;
+
+        pthread_mutex_lock(&chunk_lock);
+        b = chunk_next;
+        chunk_next = (b < blocks) ? b + chunk_blocks : b;
+        pthread_mutex_unlock(&chunk_lock);
+        if (b >= blocks)
+            break;
+
+        bend = (b + chunk_blocks < blocks) ? b + chunk_blocks : blocks;
+
+        for (; b < bend; b++) {
+            float *const  peak = result + b * (size_t)channels;
+
+            convert(buffer, file_data + b * samples * frame_bytes, count);
+            peak_block(peak, min, max, NULL, NULL, 0, buffer, (size_t)channels, samples);
+
+            /* Associative reductions; merged across threads afterwards. */
+            for (int c = 0; c < channels; c++) {
+                sum->peak[c] = (sum->peak[c] > peak[c]) ? sum->peak[c] : peak[c];
+                sum->clipped[c] += (peak[c] >= PEAK_CLIP);
+            }
+        }
+    }
+
+    free(max);
+    free(min);
+    free(buffer);
+    return NULL;
+}
+
+static uint32_t le16(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Parse a RIFF WAVE header; set format, channels, rate, and the data extent. Returns 0 or errno. */
+static int parse_wav(const unsigned char *data, size_t size, size_t *offset, size_t *length)
+{
+    size_t  at = 12;
+    int     have_fmt = 0;
+
+    if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+        return EINVAL;
+
+    while (at + 8 <= size) {
+        const unsigned char *const  chunk = data + at;
+        const size_t                len = le32(chunk + 4);
+
+        if (!memcmp(chunk, "fmt ", 4)) {
+            if (len < 16 || at + 8 + len > size)
+                return EINVAL;
+
+            unsigned int  tag = le16(chunk + 8);
+            const int     bits = (int)le16(chunk + 22);
+
+            /* WAVE_FORMAT_EXTENSIBLE: the real tag starts the subformat GUID. */
+            if (tag == 0xFFFE) {
+                if (len < 40)
+                    return EINVAL;
+                tag = le16(chunk + 32);
+            }
+
+            channels = (int)le16(chunk + 10);
+            rate = (int)le32(chunk + 12);
+
+            if (tag == 1 && bits == 16)
+                format = FORMAT_S16LE;
+            else
+            if (tag == 1 && bits == 24)
+                format = FORMAT_S24LE;
+            else
+            if (tag == 1 && bits == 32)
+                format = FORMAT_S32LE;
+            else
+            if (tag == 3 && bits == 32)
+                format = FORMAT_F32LE;
+            else
+                return ENOTSUP;
+
+            have_fmt = 1;
+        } else
+        if (!memcmp(chunk, "data", 4)) {
+            if (!have_fmt)
+                return EINVAL;
+            *offset = at + 8;
+            /* Recorders that were cut short leave a bogus length; trust the file size instead. */
+            *length = (len > size - *offset) ? size - *offset : len;
+            return 0;
+        }
+
+        at += 8 + len + (len & 1);
+    }
+
+    return EINVAL;
+}
+
+
+static const char *skip_lws(const char *from)
+{
+    if (!from)
+        return NULL;
+    while (isspace((unsigned char)(*from)))
+        from++;
+    return from;
+}
+
+static const char *parse_int(const char *from, int *to)
+{
+    const char  *next = from;
+    long         val;
+
+    if (!from || *from == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    errno = 0;
+    val = strtol(from, (char **)(&next), 0);
+    if (errno)
+        return NULL;
+    if (next == from) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((long)(int)(val) != val) {
+        errno = ERANGE;
+        return NULL;
+    }
+
+    if (to)
+        *to = val;
+
+    errno = 0;
+    return next;
+}
+
+
+int usage(const char *arg0)
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s -h | --help\n", arg0);
+    fprintf(stderr, "       %s [ OPTIONS ] FILE\n", arg0);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "       -c CHANNELS  Number of channels (raw files)\n");
+    fprintf(stderr, "       -r RATE      Samples per second (raw files)\n");
+    fprintf(stderr, "       -f FORMAT    Sample format (raw files)\n");
+    fprintf(stderr, "       -u COUNT     Peak calculations per second\n");
+    fprintf(stderr, "       -j THREADS   Number of threads; 0 for one per CPU\n");
+    fprintf(stderr, "Formats:\n");
+    fprintf(stderr, "       -f s16       16-bit signed little-endian\n");
+    fprintf(stderr, "       -f s24       24-bit signed little-endian\n");
+    fprintf(stderr, "       -f s32       32-bit signed little-endian\n");
+    fprintf(stderr, "       -f f32       32-bit float little-endian\n");
+    fprintf(stderr, "WAV files supply their own channels, rate, and format.\n");
+    fprintf(stderr, "Output is one line per block: start time, then peak amplitude per channel.\n");
+    fprintf(stderr, "\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *arg0 = (argc > 0 && argv && argv[0] && argv[0][0]) ? argv[0] : "(this)";
+    const char *p;
+    int         opt, val;
+
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C");  /* Output is meant for other tools. */
+
+    if (argc > 1 && !strcmp(argv[1], "--help"))
+        return usage(arg0);
+
+    while ((opt = getopt(argc, argv, "hc:r:f:u:j:")) != -1) {
+        switch (opt) {
+
+        case 'h':
+            return usage(arg0);
+
+        case 'c':
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != '\0' || val < 1 || val > MAX_CHANNELS) {
+                fprintf(stderr, "%s: Invalid number of channels.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            channels = val;
+            break;
+
+        case 'r':
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != '\0' || val < 128 || val > MAX_RATE) {
+                fprintf(stderr, "%s: Invalid sample rate.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            rate = val;
+            break;
+
+        case 'f':
+            if (!strcasecmp(optarg, "s16"))
+                format = FORMAT_S16LE;
+            else
+            if (!strcasecmp(optarg, "s24"))
+                format = FORMAT_S24LE;
+            else
+            if (!strcasecmp(optarg, "s32"))
+                format = FORMAT_S32LE;
+            else
+            if (!strcasecmp(optarg, "f32"))
+                format = FORMAT_F32LE;
+            else {
+                fprintf(stderr, "%s: Unsupported sample format.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'u':
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != '\0' || val < 1 || val > 200) {
+                fprintf(stderr, "%s: Invalid number of peak updates per second.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            updates = val;
+            break;
+
+        case 'j':
+            p = skip_lws(parse_int(optarg, &val));
+            if (!p || *p != '\0' || val < 0 || val > MAX_THREADS) {
+                fprintf(stderr, "%s: Invalid number of threads.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            threads = val;
+            break;
+
+        case '?':
+            /* getopt() has already printed an error message. */
+            return EXIT_FAILURE;
+
+        default:
+            /* Bug catcher: This should never occur. */
+            fprintf(stderr, "getopt() returned %d ('%c')!\n", opt, opt);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        fprintf(stderr, "%s: Exactly one input file expected.\n", (optind < argc) ? argv[argc - 1] : arg0);
+        return EXIT_FAILURE;
+    }
+
+    const char *const  path = argv[optind];
+    struct stat        info;
+    int                fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        fprintf(stderr, "%s: %s.\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (info.st_size < 1) {
+        fprintf(stderr, "%s: Empty file.\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    /* One mapping for the whole file; threads fault in their own chunks, no per-block syscalls. */
+    const size_t        size = (size_t)info.st_size;
+    unsigned char      *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: Cannot map file: %s.\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    size_t  offset = 0, length = size;
+    if (size >= 4 && !memcmp(map, "RIFF", 4)) {
+        val = parse_wav(map, size, &offset, &length);
+        if (val || channels < 1 || channels > MAX_CHANNELS || rate < 1 || rate > MAX_RATE) {
+            fprintf(stderr, "%s: Unsupported WAV file: %s.\n", path, strerror(val ? val : EINVAL));
+            munmap(map, size);
+            return EXIT_FAILURE;
+        }
+    }
+
+    samples = (size_t)(rate / updates);
+    if (samples < 1)
+        samples = 1;
+
+    file_data = map + offset;
+    frame_bytes = (size_t)channels * format_bytes[format];
+    blocks = length / (frame_bytes * samples);
+    chunk_blocks = CHUNK_BYTES / (frame_bytes * samples);
+    if (chunk_blocks < 1)
+        chunk_blocks = 1;
+
+    if (threads < 1) {
+        const long  n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (n < 1) ? 1 : (n > MAX_THREADS) ? MAX_THREADS : (int)n;
+    }
+    if ((size_t)threads > (blocks + chunk_blocks - 1) / chunk_blocks)
+        threads = (blocks > 0) ? (int)((blocks + chunk_blocks - 1) / chunk_blocks) : 1;
+
+    result = malloc((blocks > 0 ? blocks : 1) * (size_t)channels * sizeof result[0]);
+    pthread_t       *thread = calloc((size_t)threads, sizeof thread[0]);
+    struct summary  *sum = calloc((size_t)threads, sizeof sum[0]);
+    if (!result || !thread || !sum) {
+        fprintf(stderr, "Out of memory.\n");
+        munmap(map, size);
+        return EXIT_FAILURE;
+    }
+    for (int t = 0; t < threads; t++) {
+        sum[t].peak = calloc((size_t)channels, sizeof sum[t].peak[0]);
+        sum[t].clipped = calloc((size_t)channels, sizeof sum[t].clipped[0]);
+        if (!sum[t].peak || !sum[t].clipped) {
+            fprintf(stderr, "Out of memory.\n");
+            munmap(map, size);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int  started = 0;
+    for (int t = 0; t < threads; t++) {
+        val = pthread_create(&thread[t], NULL, worker, &sum[t]);
+        if (val) {
+            sum[t].err = val;
+            break;
+        }
+        started++;
+    }
+    for (int t = 0; t < started; t++)
+        pthread_join(thread[t], NULL);
+
+    /* Merge per-thread summaries; max and sum are associative, so order does not matter. */
+    for (int t = 0; t < threads; t++) {
+        if (sum[t].err) {
+            fprintf(stderr, "%s: %s.\n", path, strerror(sum[t].err));
+            munmap(map, size);
+            return EXIT_FAILURE;
+        }
+        if (t > 0) {
+            for (int c = 0; c < channels; c++) {
+                sum[0].peak[c] = (sum[0].peak[c] > sum[t].peak[c]) ? sum[0].peak[c] : sum[t].peak[c];
+                sum[0].clipped[c] += sum[t].clipped[c];
+            }
+        }
+    }
+
+    for (size_t b = 0; b < blocks; b++) {
+        printf("%.6f", (double)(b * samples) / (double)rate);
+        for (int c = 0; c < channels; c++)
+            printf("\t%.6f", result[b * (size_t)channels + c]);
+        putchar('\n');
+    }
+
+    fprintf(stderr, "%s: %zu blocks of %zu samples, %d channels at %d Hz, %d threads.\n",
+                    path, blocks, samples, channels, rate, threads);
+    for (int c = 0; c < channels; c++)
+        fprintf(stderr, "Channel %d: peak %.6f, %zu clipped blocks.\n", c, sum[0].peak[c], sum[0].clipped[c]);
+
+    munmap(map, size);
+
+    if (fflush(stdout) || ferror(stdout)) {
+        fprintf(stderr, "Error writing output.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -3,94 +3,732 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <limits.h>
-#include <pulse/simple.h>
-#include <pulse/error.h>
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pulse/pulseaudio.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include "vu.h"
+#include "peak.h"
+
+/* Reconnection backoff limits, in microseconds. */
+#ifndef  LINK_DELAY_MIN
+#define  LINK_DELAY_MIN   100000
+#endif
+
+#ifndef  LINK_DELAY_MAX
+#define  LINK_DELAY_MAX  5000000
+#endif
+
+/* Smoothing time constant for channel pair measurements, in seconds. */
+#ifndef  PAIR_TIME
+#define  PAIR_TIME  0.3
+#endif
+
+/* Per-stream state is laid out in cache lines of this size. */
+#ifndef  CACHE_LINE
+#define  CACHE_LINE  64
+#endif
+
+#ifndef  MAX_CHANNELS
+#define  MAX_CHANNELS  128
+#endif
+
+/* Full scale squared, 2^62, and the -90 dB floor below which a channel counts as silent. */
+#define  FULL_SCALE2  4611686018427387904.0
+#define  PAIR_FLOOR   1e-9
+
+/*
+ * Level histograms have 1 << HIST_STEPS bins per octave, from 2^-HIST_OCTAVES
+ * (about -120 dB) up to full scale.  The bin is read straight off the float
+ * representation: the exponent and the top HIST_STEPS mantissa bits.
+*/
+#define  HIST_STEPS    2
+#define  HIST_OCTAVES  20
+#define  HIST_BINS     ((HIST_OCTAVES << HIST_STEPS) + 1)
+#define  HIST_BASE     ((127 - HIST_OCTAVES) << HIST_STEPS)
+
+/*
+ * Detector tuning, in power ratios per block energy.  The noise floor
+ * follows drops at once and rises by DETECT_RISE dB per second; a channel
+ * turns active DETECT_ON above the floor, and inactive below DETECT_OFF.
+ * A block at or above DETECT_LOUD is always active, so a steady signal
+ * that the floor has risen to meet is not mistaken for a dead channel.
+*/
+#define  DETECT_RISE    1.0         /* dB per second */
+#define  DETECT_ON      8.0f        /* 9 dB */
+#define  DETECT_OFF     4.0f        /* 6 dB */
+#define  DETECT_MIN     1e-12f      /* -120 dB; floor never drops below */
+#define  DETECT_LOUD    1e-6f       /* -60 dBFS mean square */
+#define  DETECT_SOUND   0.5         /* Seconds of activity to clear silence */
+#define  DETECT_DC      214748      /* Largest spread, max - min, of a stuck channel: -80 dB of full scale */
+#define  DETECT_DC_MIN  2147483     /* -60 dB of full scale; smaller offsets are not worth reporting */
+
+struct detect {
+    float       floor;      /* Noise floor mean square */
+    uint32_t    quiet;      /* Consecutive inactive blocks */
+    uint32_t    loud;       /* Consecutive active blocks */
+    uint32_t    stuck;      /* Consecutive constant blocks */
+    uint32_t    moving;     /* Consecutive non-constant blocks */
+    uint8_t     active;
+    uint8_t     silent;     /* VU_EVENT_SILENT reported */
+    uint8_t     dc;         /* VU_EVENT_DC reported */
+};
+
+struct pair_sum {
+    double      ll;
+    double      rr;
+    double      lr;
+    double      n;          /* Samples, with the same weights */
+};
 
 static volatile int     done = 0;
 
-static pa_simple       *audio = NULL;
+static int             *pair_left = NULL;       /* Selected by vu_pairs() for the next vu_start() */
+static int             *pair_right = NULL;
+static int              pair_count = 0;
+static struct vu_group *group_def = NULL;       /* Selected by vu_groups() for the next vu_start() */
+static int              group_count = 0;
+static vu_event_handler detect_handler = NULL;  /* Selected by vu_detect() for the next vu_start() */
+static vu_batch_handler batch_handler = NULL;   /* Selected by vu_batches() for the next vu_start() */
+static void            *batch_context = NULL;
+static int              batch_blocks = 0;
+static void            *detect_context = NULL;
+static float            detect_seconds = 0.0f;
+
+static char            *audio_server = NULL;
+static char            *audio_appname = NULL;
+static char            *audio_devname = NULL;   /* NULL follows the default source */
+static char            *audio_stream = NULL;
+static pa_sample_spec   audio_spec;
+static pa_buffer_attr   audio_attr;
 static size_t           audio_channels = 0;
 static size_t           audio_samples = 0;
+static size_t           audio_fill = 0;         /* Bytes of audio_buffer filled so far */
+
+/*
+ * All per-stream arrays live in one cache-line aligned arena: first the
+ * producer region, touched only by the worker, then the consumer region,
+ * which the worker writes and readers copy under peak_lock, or for the
+ * level histograms, under the shared.hist_seq sequence lock.  No cache
+ * line is shared between the two regions, nor between arrays.
+*/
+static unsigned char   *arena = NULL;
+static size_t           arena_producer = 0;     /* Bytes in the producer region */
+static size_t           arena_consumer = 0;     /* Bytes in the consumer region */
+
 static int32_t         *audio_buffer = NULL;    /* audio_buffer[audio_samples][audio_channels] */
 static int32_t         *audio_min = NULL;       /* audio_min[audio_channels] */
 static int32_t         *audio_max = NULL;       /* audio_max[audio_channels] */
+static float           *audio_peak = NULL;      /* audio_peak[audio_channels + audio_groups] */
+static double          *audio_power = NULL;     /* audio_power[audio_channels] */
+static size_t           audio_groups = 0;
+static struct vu_group *audio_group = NULL;     /* audio_group[audio_groups] */
+static size_t           audio_pairs = 0;
+static struct peak_pair *audio_pair = NULL;     /* audio_pair[audio_pairs], per block */
+static struct pair_sum *audio_sum = NULL;       /* audio_sum[audio_pairs], smoothed */
+static struct vu_phase *audio_phase = NULL;     /* audio_phase[audio_pairs], copied to phase */
+static float           *audio_scope = NULL;     /* audio_scope[audio_pairs][scope_points][2], copied to scope */
+static double           audio_decay = 0.0;      /* Smoothing weight of the previous blocks */
+static struct detect   *audio_detect = NULL;    /* audio_detect[audio_channels], if detecting */
+static vu_event_handler audio_handler = NULL;
+static void            *audio_context = NULL;
+static float            audio_rise = 1.0f;      /* Noise floor rise per block */
+static uint32_t         audio_wait = 0;         /* Blocks before reporting a condition */
+static uint32_t         audio_clear = 0;        /* Blocks before clearing silence */
+static float            audio_block = 0.0f;     /* Seconds per block */
+static float           *audio_batch_peak = NULL;    /* audio_batch_peak[audio_batch][audio_channels + audio_groups] */
+static float           *audio_batch_rms = NULL;     /* audio_batch_rms[audio_batch][audio_channels] */
+static vu_batch_handler audio_batcher = NULL;
+static void            *audio_batcher_context = NULL;
+static size_t           audio_batch = 0;        /* Blocks per batch */
+static size_t           audio_batched = 0;      /* Blocks in the current batch */
+static uint64_t         audio_batch_first = 0;  /* Sequence number of the first block in the current batch */
 static pthread_t        audio_thread;
 
+static pa_mainloop     *link_loop = NULL;
+static pa_context      *link_context = NULL;
+static pa_stream       *link_stream = NULL;
+static long             link_delay = LINK_DELAY_MIN;
+static volatile int     link_event = 0;         /* Server event worth retrying for */
+static volatile int     link_move = 0;          /* Default source changed */
+static uint64_t         link_dropped = 0;       /* Frames lost to stream holes */
+static uint64_t         link_overruns = 0;      /* Server-side overflows */
+static uint64_t         link_connects = 0;      /* Successful stream connections */
+
+/*
+ * Statistics snapshot for monitoring, published by the worker after each
+ * block under a sequence lock: readers retry instead of waiting, and the
+ * worker never waits for them.  Static storage, so it outlives vu_stop().
+*/
+static struct {
+    atomic_uint         seq;        /* Odd while being written */
+    struct vu_stats     stats;
+    float               peak[MAX_CHANNELS];
+    uint64_t            clipped[MAX_CHANNELS];
+} snapshot __attribute__((aligned (CACHE_LINE)));
+
+/*
+ * Scalars the worker writes every block or state change and readers poll
+ * from other threads, on their own cache line, away from the
+ * configuration and worker-private state.
+*/
+static struct {
+    volatile int        available;  /* Blocks merged since the peaks were last read */
+    volatile int        state;      /* VU_STOPPED, ... */
+    volatile int        error;      /* Reason for VU_DISCONNECTED */
+    atomic_uint         hist_seq;   /* Odd while the level histograms are being updated */
+} shared __attribute__((aligned (CACHE_LINE))) = { 0, VU_STOPPED, 0, 0 };
+
+static atomic_uint_fast64_t  stats_reads = 0;   /* vu_peak() calls that returned data */
+
 static pthread_mutex_t  peak_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t   peak_update = PTHREAD_COND_INITIALIZER;
-static float           *peak_amplitude = NULL;
-static volatile int     peak_available = 0;
+static float           *peak_amplitude = NULL;  /* peak_amplitude[audio_channels + audio_groups] */
+static struct vu_phase *phase = NULL;           /* phase[audio_pairs] */
+static float           *scope = NULL;           /* scope[audio_pairs][VU_SCOPE_POINTS][2] */
+static size_t           scope_points = 0;
+static uint32_t        *hist_peak = NULL;       /* hist_peak[audio_channels][HIST_BINS] */
+static uint32_t        *hist_rms = NULL;        /* hist_rms[audio_channels][HIST_BINS] */
 
 int vu_peak_available(void)
 {
-    return peak_available;
+    return shared.available;
 }
 
-static void *worker(void *unused)
+int vu_state(int *err)
 {
-    (void)unused;  /* Silence warning about unused parameter. */
+    if (err)
+        *err = shared.error;
+    return shared.state;
+}
 
-    while (!done) {
-        int  err = 0;
+static void set_state(int state, int err)
+{
+    pthread_mutex_lock(&peak_lock);
+    shared.state = state;
+    shared.error = err;
+    pthread_cond_broadcast(&peak_update);
+    pthread_mutex_unlock(&peak_lock);
+}
+
+/* Histogram bin of an amplitude, without branches. */
+static inline int32_t level_bin(float amplitude)
+{
+    uint32_t  bits;
+    int32_t   i, over;
+
+    memcpy(&bits, &amplitude, sizeof bits);
+    i = (int32_t)((bits & 0x7FFFFFFFu) >> (23 - HIST_STEPS)) - HIST_BASE;
+    i &= ~(i >> 31);                /* Below range, including zero: bin 0 */
+    over = (HIST_BINS - 1) - i;
+    i += over & (over >> 31);       /* Above range: top bin */
+    return i;
+}
+
+/* Upper edge of a histogram bin, as an amplitude. */
+static float level_edge(int32_t bin)
+{
+    const uint32_t  bits = (uint32_t)(bin + HIST_BASE + 1) << (23 - HIST_STEPS);
+    float           amplitude;
 
-        if (pa_simple_read(audio, audio_buffer, audio_channels * audio_samples * sizeof audio_buffer[0], &err) < 0) {
-            done = -EIO;
+    memcpy(&amplitude, &bits, sizeof amplitude);
+    return (amplitude < 1.0f) ? amplitude : 1.0f;
+}
+
+/* Geometric centre of a histogram bin, within 1 dB of any level in it; bin 0 has no lower edge. */
+static float level_centre(int32_t bin)
+{
+    if (bin < 1)
+        return level_edge(0);
+    return sqrtf(level_edge(bin - 1) * level_edge(bin));
+}
+
+static void publish(uint64_t nsec)
+{
+    atomic_fetch_add_explicit(&snapshot.seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    snapshot.stats.blocks++;
+    snapshot.stats.block_nsec += nsec;
+    if (snapshot.stats.block_nsec_max < nsec)
+        snapshot.stats.block_nsec_max = nsec;
+    snapshot.stats.dropped = link_dropped;
+    snapshot.stats.overruns = link_overruns;
+    snapshot.stats.connects = link_connects;
+    for (size_t c = 0; c < audio_channels; c++) {
+        snapshot.peak[c] = audio_peak[c];
+        snapshot.clipped[c] += (audio_peak[c] >= PEAK_CLIP);
+    }
+
+    atomic_thread_fence(memory_order_release);
+    atomic_fetch_add_explicit(&snapshot.seq, 1, memory_order_relaxed);
+}
+
+static void notify(int type, size_t c, uint32_t blocks, float ms, const struct detect *d)
+{
+    const struct vu_event  event = {
+        .type = type,
+        .channel = (int)c,
+        .seconds = blocks * audio_block,
+        .level = sqrtf(ms),
+        .floor = sqrtf(d->floor),
+        .value = (float)(((double)audio_min[c] + (double)audio_max[c]) / 4294967296.0),
+    };
+    audio_handler(&event, audio_context);
+}
+
+/* Silent and stuck channel detector; a handful of multiplies and compares per channel per block. */
+static void detect(void)
+{
+    const float  scale = (float)(1.0 / ((double)audio_samples * FULL_SCALE2));
+
+    for (size_t c = 0; c < audio_channels; c++) {
+        struct detect *const  d = audio_detect + c;
+        const float           ms = (float)audio_power[c] * scale;
+
+        /* Noise floor drops at once, rises slowly. */
+        d->floor = (ms < d->floor) ? ms : d->floor * audio_rise;
+        d->floor = (d->floor > DETECT_MIN) ? d->floor : DETECT_MIN;
+
+        /* Activity with hysteresis between the on and off margins; loud blocks are always active. */
+        if (ms > d->floor * DETECT_ON || ms >= DETECT_LOUD)
+            d->active = 1;
+        else
+        if (ms < d->floor * DETECT_OFF)
+            d->active = 0;
+
+        d->quiet = (d->active) ? 0 : d->quiet + 1;
+        d->loud  = (d->active) ? d->loud + 1 : 0;
+
+        if (!d->silent && d->quiet >= audio_wait) {
+            d->silent = 1;
+            notify(VU_EVENT_SILENT, c, d->quiet, ms, d);
+        } else
+        if (d->silent && d->loud >= audio_clear) {
+            d->silent = 0;
+            notify(VU_EVENT_SOUND, c, d->loud, ms, d);
+        }
+
+        /* A stuck channel has no spread between its smallest and largest sample, and is not at zero. */
+        const int64_t  lo = audio_min[c], hi = audio_max[c];
+        const int      constant = (hi - lo <= DETECT_DC) && (hi > DETECT_DC_MIN || lo < -DETECT_DC_MIN);
+        d->stuck  = (constant) ? d->stuck + 1 : 0;
+        d->moving = (constant) ? 0 : d->moving + 1;
+
+        if (!d->dc && d->stuck >= audio_wait) {
+            d->dc = 1;
+            notify(VU_EVENT_DC, c, d->stuck, ms, d);
+        } else
+        if (d->dc && d->moving >= audio_clear) {
+            d->dc = 0;
+            notify(VU_EVENT_DC_CLEAR, c, d->moving, ms, d);
+        }
+    }
+}
+
+/* Hand the blocks collected so far to the batch handler. */
+static void flush(void)
+{
+    if (!audio_batched)
+        return;
+
+    const struct vu_batch  batch = {
+        .first = audio_batch_first,
+        .blocks = (int)audio_batched,
+        .meters = (int)(audio_channels + audio_groups),
+        .channels = (int)audio_channels,
+        .peak = audio_batch_peak,
+        .rms = audio_batch_rms,
+    };
+    audio_batched = 0;
+    audio_batcher(&batch, audio_batcher_context);
+}
+
+/* Append this block's results to the current batch; the snapshot block count is its sequence number. */
+static void batch(void)
+{
+    const size_t  total = audio_channels + audio_groups;
+    const double  rms_scale = 1.0 / ((double)audio_samples * FULL_SCALE2);
+
+    if (!audio_batched)
+        audio_batch_first = snapshot.stats.blocks;
+
+    memcpy(audio_batch_peak + audio_batched * total, audio_peak, total * sizeof audio_peak[0]);
+    float *const  rms = audio_batch_rms + audio_batched * audio_channels;
+    for (size_t c = 0; c < audio_channels; c++)
+        rms[c] = (float)sqrt(audio_power[c] * rms_scale);
+
+    if (++audio_batched >= audio_batch)
+        flush();
+}
+
+static void update(void)
+{
+    struct timespec  started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    peak_block(audio_peak, audio_min, audio_max, audio_power, audio_pair, audio_pairs, audio_buffer, audio_channels, audio_samples);
+
+    /* Group reductions over the per-channel results, into the virtual channels. */
+    const double  power_scale = 1.0 / ((double)audio_samples * FULL_SCALE2);
+    for (size_t g = 0; g < audio_groups; g++) {
+        const size_t  first = audio_group[g].first;
+        if (audio_group[g].type == VU_GROUP_POWER)
+            audio_peak[audio_channels + g] = peak_group_power(audio_power + first, audio_group[g].count, power_scale);
+        else
+            audio_peak[audio_channels + g] = peak_group_max(audio_peak + first, audio_group[g].count);
+    }
+
+    /* Phase measurements and goniometer points, computed before taking peak_lock. */
+    for (size_t p = 0; p < audio_pairs; p++) {
+        struct pair_sum *const  sum = audio_sum + p;
+
+        sum->ll = audio_decay * sum->ll + audio_pair[p].ll;
+        sum->rr = audio_decay * sum->rr + audio_pair[p].rr;
+        sum->lr = audio_decay * sum->lr + audio_pair[p].lr;
+        sum->n  = audio_decay * sum->n  + (double)audio_samples;
+
+        const double  floor = sum->n * FULL_SCALE2 * PAIR_FLOOR;
+        const double  norm = 0.25 / (sum->n * FULL_SCALE2);
+
+        if (sum->ll > floor && sum->rr > floor)
+            audio_phase[p].correlation = (float)(sum->lr / sqrt(sum->ll * sum->rr));
+        else
+            audio_phase[p].correlation = 0.0f;
+        audio_phase[p].mid  = (float)((sum->ll + sum->rr + 2.0 * sum->lr) * norm);
+        audio_phase[p].side = (float)((sum->ll + sum->rr - 2.0 * sum->lr) * norm);
+
+        const size_t   step = audio_samples / scope_points;
+        const size_t   left = audio_pair[p].left;
+        const size_t   right = audio_pair[p].right;
+        float *const   xy = audio_scope + 2 * scope_points * p;
+        for (size_t i = 0; i < scope_points; i++) {
+            const int32_t *const  frame = audio_buffer + i * step * audio_channels;
+            const float           l = frame[left] / 2147483648.0f;
+            const float           r = frame[right] / 2147483648.0f;
+            xy[2*i + 0] = 0.5f * (l - r);
+            xy[2*i + 1] = 0.5f * (l + r);
+        }
+    }
+
+    /* Update peak amplitudes. */
+    const size_t  total = audio_channels + audio_groups;
+    pthread_mutex_lock(&peak_lock);
+    if (shared.available++) {
+        for (size_t c = 0; c < total; c++)
+            peak_amplitude[c] = (peak_amplitude[c] > audio_peak[c]) ? peak_amplitude[c] : audio_peak[c];
+    } else {
+        for (size_t c = 0; c < total; c++)
+            peak_amplitude[c] = audio_peak[c];
+    }
+
+    /* Only copies under the lock. */
+    if (audio_pairs > 0) {
+        memcpy(phase, audio_phase, audio_pairs * sizeof phase[0]);
+        for (size_t p = 0; p < audio_pairs; p++)
+            memcpy(scope + 2 * VU_SCOPE_POINTS * p, audio_scope + 2 * scope_points * p, 2 * scope_points * sizeof scope[0]);
+    }
+
+    pthread_cond_broadcast(&peak_update);
+    pthread_mutex_unlock(&peak_lock);
+
+    /* Session level histograms, one increment each per channel; readers copy them under a sequence lock. */
+    atomic_fetch_add_explicit(&shared.hist_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t c = 0; c < audio_channels; c++) {
+        hist_peak[c * HIST_BINS + level_bin(audio_peak[c])]++;
+        hist_rms[c * HIST_BINS + level_bin((float)sqrt(audio_power[c] * power_scale))]++;
+    }
+    atomic_thread_fence(memory_order_release);
+    atomic_fetch_add_explicit(&shared.hist_seq, 1, memory_order_relaxed);
+
+    if (audio_handler)
+        detect();
+    if (audio_batcher)
+        batch();
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    publish((uint64_t)(finished.tv_sec - started.tv_sec) * 1000000000u + (uint64_t)finished.tv_nsec - (uint64_t)started.tv_nsec);
+}
+
+/* Run one mainloop iteration, waiting at most usec microseconds (negative for no limit). */
+static void link_iterate(long usec)
+{
+    if (usec > INT_MAX)
+        usec = INT_MAX;
+
+    if (pa_mainloop_prepare(link_loop, (usec < 0) ? -1 : (int)usec) < 0)
+        return;
+    if (pa_mainloop_poll(link_loop) < 0)
+        return;
+    pa_mainloop_dispatch(link_loop);
+}
+
+/* Wait before the next connection attempt, unless stopped or a server event says to retry now. */
+static void link_backoff(void)
+{
+    struct timespec  now, until;
+
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec  += link_delay / 1000000;
+    until.tv_nsec += (link_delay % 1000000) * 1000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    link_delay = (link_delay < LINK_DELAY_MAX / 2) ? 2 * link_delay : LINK_DELAY_MAX;
+
+    while (!done && !link_event) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const long  usec = (long)(until.tv_sec - now.tv_sec) * 1000000L + (until.tv_nsec - now.tv_nsec) / 1000L;
+        if (usec <= 0)
             break;
+        link_iterate(usec);
+    }
+
+    link_event = 0;
+}
+
+static void link_server_info(pa_context *c, const pa_server_info *info, void *unused)
+{
+    (void)c; (void)unused;  /* Silence warning about unused parameters. */
+
+    if (!info || !info->default_source_name || !link_stream)
+        return;
+    if (pa_stream_get_state(link_stream) != PA_STREAM_READY)
+        return;
+
+    const char *const  current = pa_stream_get_device_name(link_stream);
+    if (current && strcmp(current, info->default_source_name))
+        link_move = 1;
+}
+
+static void link_subscribed(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *unused)
+{
+    (void)idx; (void)unused;  /* Silence warning about unused parameters. */
+
+    const unsigned int  facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+    const unsigned int  type = t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+    /* A source appeared; if we are waiting for one, try again immediately. */
+    if (facility == PA_SUBSCRIPTION_EVENT_SOURCE && type == PA_SUBSCRIPTION_EVENT_NEW)
+        link_event = 1;
+
+    /* The default source may have changed. */
+    if (facility == PA_SUBSCRIPTION_EVENT_SERVER && !audio_devname) {
+        pa_operation *op = pa_context_get_server_info(c, link_server_info, NULL);
+        if (op)
+            pa_operation_unref(op);
+    }
+}
+
+static void link_close(void)
+{
+    if (link_stream) {
+        pa_stream_disconnect(link_stream);
+        pa_stream_unref(link_stream);
+        link_stream = NULL;
+    }
+    if (link_context) {
+        pa_context_disconnect(link_context);
+        pa_context_unref(link_context);
+        link_context = NULL;
+    }
+}
+
+static int link_context_open(void)
+{
+    pa_context_state_t  state;
+    int                 err;
+
+    link_context = pa_context_new(pa_mainloop_get_api(link_loop), audio_appname);
+    if (!link_context)
+        return -ENOMEM;
+
+    if (pa_context_connect(link_context, audio_server, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        err = pa_context_errno(link_context);
+        link_close();
+        return err ? err : PA_ERR_CONNECTIONREFUSED;
+    }
+
+    while (!done) {
+        state = pa_context_get_state(link_context);
+        if (state == PA_CONTEXT_READY) {
+            pa_operation *op;
+
+            link_event = 0;
+            link_move = 0;
+            pa_context_set_subscribe_callback(link_context, link_subscribed, NULL);
+            op = pa_context_subscribe(link_context, PA_SUBSCRIPTION_MASK_SOURCE | PA_SUBSCRIPTION_MASK_SERVER, NULL, NULL);
+            if (op)
+                pa_operation_unref(op);
+            return 0;
         }
+        if (!PA_CONTEXT_IS_GOOD(state))
+            break;
+        link_iterate(-1);
+    }
+
+    err = pa_context_errno(link_context);
+    link_close();
+    return err ? err : PA_ERR_CONNECTIONTERMINATED;
+}
+
+static void link_overflow(pa_stream *s, void *unused)
+{
+    (void)s; (void)unused;  /* Silence warning about unused parameters. */
+    link_overruns++;
+}
+
+static int link_stream_open(void)
+{
+    pa_stream_state_t  state;
+    pa_stream_flags_t  flags = PA_STREAM_ADJUST_LATENCY;
+    int                err;
+
+    /* A named source is followed across unplug/replug; do not let the server move us elsewhere. */
+    if (audio_devname)
+        flags |= PA_STREAM_DONT_MOVE;
+
+    link_stream = pa_stream_new(link_context, audio_stream, &audio_spec, NULL);
+    if (!link_stream)
+        return pa_context_errno(link_context);
+
+    pa_stream_set_overflow_callback(link_stream, link_overflow, NULL);
+
+    if (pa_stream_connect_record(link_stream, audio_devname, &audio_attr, flags) < 0)
+        goto fail;
 
-        for (size_t c = 0; c < audio_channels; c++) {
-            audio_min[c] = (int32_t)( 2147483647);
-            audio_max[c] = (int32_t)(-2147483648);
+    while (!done) {
+        state = pa_stream_get_state(link_stream);
+        if (state == PA_STREAM_READY) {
+            audio_fill = 0;
+            link_move = 0;
+            link_connects++;
+            return 0;
         }
+        if (!PA_STREAM_IS_GOOD(state))
+            break;
+        link_iterate(-1);
+    }
+
+fail:
+    err = pa_context_errno(link_context);
+    pa_stream_disconnect(link_stream);
+    pa_stream_unref(link_stream);
+    link_stream = NULL;
+    return err ? err : PA_ERR_NOENTITY;
+}
 
-        int32_t *const  end = audio_buffer + audio_channels * audio_samples;
-        int32_t        *ptr = audio_buffer;
+/* Consume everything readable from the stream, updating peaks for each complete block. */
+static void link_read(void)
+{
+    const size_t  block = audio_channels * audio_samples * sizeof audio_buffer[0];
+    const void   *data;
+    size_t        bytes;
+
+    while (pa_stream_readable_size(link_stream) > 0) {
+        if (pa_stream_peek(link_stream, &data, &bytes) < 0 || bytes < 1)
+            return;
+
+        /* data is NULL for a hole in the stream; just skip it. */
+        if (!data)
+            link_dropped += bytes / (audio_channels * sizeof audio_buffer[0]);
+        else {
+            const unsigned char  *src = data;
+            while (bytes > 0) {
+                size_t  n = block - audio_fill;
+                if (n > bytes)
+                    n = bytes;
 
-        /* Min-max peak detect. */
-        while (ptr < end) {
-            for (size_t c = 0; c < audio_channels; c++) {
-                const int32_t  s = *(ptr++);
-                audio_min[c] = (audio_min[c] < s) ? audio_min[c] : s;
-                audio_max[c] = (audio_max[c] > s) ? audio_max[c] : s;
+                memcpy((unsigned char *)audio_buffer + audio_fill, src, n);
+                audio_fill += n;
+                src += n;
+                bytes -= n;
+
+                if (audio_fill >= block) {
+                    update();
+                    audio_fill = 0;
+                }
             }
         }
 
-        /* absolute values. */
-        for (size_t c = 0; c < audio_channels; c++) {
-            if (audio_min[c] == (int32_t)(-2147483648))
-                audio_min[c] =  (int32_t)( 2147483647);
-            else
-            if (audio_min[c] < 0)
-                audio_min[c] = -audio_min[c];
-            else
-                audio_min[c] = 0;
-
-            if (audio_max[c] < 0)
-                audio_max[c] = 0;
+        pa_stream_drop(link_stream);
+    }
+}
+
+static void *worker(void *unused)
+{
+    (void)unused;  /* Silence warning about unused parameter. */
+    int  err;
+
+    while (!done) {
+        /* Connect to the server. */
+        set_state(VU_CONNECTING, shared.error);
+        err = link_context_open();
+        if (err) {
+            if (!done)
+                set_state(VU_DISCONNECTED, err);
+            link_backoff();
+            continue;
         }
 
-        /* Update peak amplitudes. */
-        pthread_mutex_lock(&peak_lock);
-        if (peak_available++) {
-            for (size_t c = 0; c < audio_channels; c++) {
-                const float  amplitude = (audio_max[c] > audio_min[c]) ? audio_max[c] / 2147483647.0f : audio_min[c] / 2147483647.0f;
-                peak_amplitude[c] = (peak_amplitude[c] > amplitude) ? peak_amplitude[c] : amplitude;
+        /* Record from the source for as long as the server connection lasts. */
+        while (!done && pa_context_get_state(link_context) == PA_CONTEXT_READY) {
+            err = link_stream_open();
+            if (err) {
+                if (!done)
+                    set_state(VU_DISCONNECTED, err);
+                link_backoff();
+                continue;
             }
-        } else {
-            for (size_t c = 0; c < audio_channels; c++) {
-                const float  amplitude = (audio_max[c] > audio_min[c]) ? audio_max[c] / 2147483647.0f : audio_min[c] / 2147483647.0f;
-                peak_amplitude[c] = amplitude;
+
+            link_delay = LINK_DELAY_MIN;
+            set_state(VU_CONNECTED, 0);
+
+            while (!done && !link_move &&
+                   pa_context_get_state(link_context) == PA_CONTEXT_READY &&
+                   pa_stream_get_state(link_stream) == PA_STREAM_READY) {
+                link_iterate(-1);
+                link_read();
             }
+
+            err = pa_context_errno(link_context);
+
+            pa_stream_disconnect(link_stream);
+            pa_stream_unref(link_stream);
+            link_stream = NULL;
+
+            /* Consumers should not sit on a partial batch across a gap. */
+            if (audio_batcher)
+                flush();
+
+            /* Moving to the new default source is immediate; anything else is a disconnect. */
+            if (link_move) {
+                link_move = 0;
+                continue;
+            }
+            if (!done)
+                set_state(VU_DISCONNECTED, err ? err : PA_ERR_CONNECTIONTERMINATED);
         }
-        pthread_cond_broadcast(&peak_update);
-        pthread_mutex_unlock(&peak_lock);
+
+        if (!done)
+            set_state(VU_DISCONNECTED, pa_context_errno(link_context));
+        link_close();
+        link_backoff();
     }
 
+    link_close();
+
+    if (audio_batcher)
+        flush();
+
     /* Wake up all waiters on the peak update, too. */
-    pthread_cond_broadcast(&peak_update);
+    set_state(VU_STOPPED, 0);
     return NULL;
 }
 
@@ -106,31 +744,73 @@ const char *vu_error(int err)
         return "OK";
 }
 
-void vu_stop(void)
+static void release(void)
 {
-    if (audio) {
-        if (!done)
-            done = 1;
-        pthread_join(audio_thread, NULL);
-        pa_simple_free(audio);
-        audio_thread = pthread_self();
-        audio = NULL;
+    if (link_loop) {
+        pa_mainloop_free(link_loop);
+        link_loop = NULL;
     }
 
-    free(audio_buffer);  /* Note: free(NULL) is OK. */
-    free(audio_min);
-    free(audio_max);
+    free(arena);  /* Note: free(NULL) is OK. */
+    free(audio_server);
+    free(audio_appname);
+    free(audio_devname);
+    free(audio_stream);
+
+    arena = NULL;
+    arena_producer = 0;
+    arena_consumer = 0;
 
     audio_buffer = NULL;
     audio_min    = NULL;
     audio_max    = NULL;
+    audio_peak   = NULL;
+    audio_power  = NULL;
+    audio_pair   = NULL;
+    audio_sum    = NULL;
+    audio_phase  = NULL;
+    audio_scope  = NULL;
+    audio_detect = NULL;
+    audio_batch_peak = NULL;
+    audio_batch_rms = NULL;
+    audio_batcher = NULL;
+    audio_batcher_context = NULL;
+    audio_handler = NULL;
+    audio_context = NULL;
+    audio_pairs  = 0;
+    audio_group  = NULL;
+    audio_groups = 0;
+    audio_server = NULL;
+    audio_appname = NULL;
+    audio_devname = NULL;
+    audio_stream  = NULL;
     audio_channels = 0;
     audio_samples  = 0;
+    audio_fill     = 0;
 
-    pthread_mutex_lock(&peak_lock);
-    free(peak_amplitude);
     peak_amplitude = NULL;
-    peak_available = 0;
+    shared.available = 0;
+    phase = NULL;
+    scope = NULL;
+    scope_points = 0;
+    hist_peak = NULL;
+    hist_rms = NULL;
+}
+
+void vu_stop(void)
+{
+    if (link_loop) {
+        if (!done)
+            done = 1;
+        pa_mainloop_wakeup(link_loop);
+        pthread_join(audio_thread, NULL);
+        audio_thread = pthread_self();
+    }
+
+    pthread_mutex_lock(&peak_lock);
+    release();
+    shared.state = VU_STOPPED;
+    shared.error = 0;
     pthread_mutex_unlock(&peak_lock);
 }
 
@@ -138,7 +818,7 @@ void vu_stop(void)
 void vu_wait(void)
 {
     pthread_mutex_lock(&peak_lock);
-    if (audio && !done)
+    if (link_loop && !done)
         pthread_cond_wait(&peak_update, &peak_lock);
 
     pthread_mutex_unlock(&peak_lock);
@@ -148,12 +828,12 @@ void vu_wait(void)
 int vu_peak(float *to, int num)
 {
     pthread_mutex_lock(&peak_lock);
-    if (!peak_amplitude || !peak_available || audio_channels < 1) {
+    if (!peak_amplitude || !shared.available || audio_channels < 1) {
         pthread_mutex_unlock(&peak_lock);
         return 0;
     }
 
-    const int  have = (int)audio_channels;
+    const int  have = (int)(audio_channels + audio_groups);
 
     if (num > 0) {
         const int  cmax = (num < have) ? num : have;
@@ -161,12 +841,276 @@ int vu_peak(float *to, int num)
             to[c] = peak_amplitude[c];
     }
 
-    peak_available = 0;
+    shared.available = 0;
+    pthread_mutex_unlock(&peak_lock);
+    atomic_fetch_add_explicit(&stats_reads, 1, memory_order_relaxed);
+    return have;
+}
+
+
+int vu_stats(struct vu_stats *to, float *peak, uint64_t *clipped, int channels)
+{
+    unsigned int  seq;
+    int           have;
+
+    if (!to || channels < 0 || (channels > 0 && (!peak || !clipped)))
+        return -EINVAL;
+
+    do {
+        seq = atomic_load_explicit(&snapshot.seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+
+        *to = snapshot.stats;
+        have = (to->channels < channels) ? to->channels : channels;
+        if (have > 0) {
+            memcpy(peak, snapshot.peak, (size_t)have * sizeof peak[0]);
+            memcpy(clipped, snapshot.clipped, (size_t)have * sizeof clipped[0]);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&snapshot.seq, memory_order_relaxed));
+
+    /* Reader-side values are not part of the worker's snapshot. */
+    to->state = shared.state;
+    to->reads = atomic_load_explicit(&stats_reads, memory_order_relaxed);
+    to->lag   = (uint64_t)shared.available;
+    return to->channels;
+}
+
+
+int vu_phase(struct vu_phase *to, int num)
+{
+    pthread_mutex_lock(&peak_lock);
+    const int  have = (int)audio_pairs;
+
+    if (num > 0 && phase) {
+        const int  pmax = (num < have) ? num : have;
+        for (int p = 0; p < pmax; p++)
+            to[p] = phase[p];
+    }
+
+    pthread_mutex_unlock(&peak_lock);
+    return have;
+}
+
+
+int vu_scope(int pair, float *xy, int points)
+{
+    pthread_mutex_lock(&peak_lock);
+    if (!scope || pair < 0 || (size_t)pair >= audio_pairs || points < 1) {
+        pthread_mutex_unlock(&peak_lock);
+        return 0;
+    }
+
+    const int           have = (points < (int)scope_points) ? points : (int)scope_points;
+    const float *const  from = scope + 2 * VU_SCOPE_POINTS * (size_t)pair;
+    memcpy(xy, from, 2 * (size_t)have * sizeof xy[0]);
+
     pthread_mutex_unlock(&peak_lock);
     return have;
 }
 
 
+int vu_pairs(const int *left, const int *right, int pairs)
+{
+    int  *new_left = NULL, *new_right = NULL;
+
+    if (pairs < 0 || (pairs > 0 && (!left || !right)))
+        return -EINVAL;
+
+    if (pairs > 0) {
+        for (int p = 0; p < pairs; p++)
+            if (left[p] < 0 || right[p] < 0)
+                return -EINVAL;
+
+        new_left = malloc((size_t)pairs * sizeof new_left[0]);
+        new_right = malloc((size_t)pairs * sizeof new_right[0]);
+        if (!new_left || !new_right) {
+            free(new_right);
+            free(new_left);
+            return -ENOMEM;
+        }
+        memcpy(new_left, left, (size_t)pairs * sizeof new_left[0]);
+        memcpy(new_right, right, (size_t)pairs * sizeof new_right[0]);
+    }
+
+    pthread_mutex_lock(&peak_lock);
+    free(pair_left);
+    free(pair_right);
+    pair_left = new_left;
+    pair_right = new_right;
+    pair_count = pairs;
+    pthread_mutex_unlock(&peak_lock);
+    return 0;
+}
+
+
+int vu_percentiles(int level, const float *percent, int count, float *to, int channels)
+{
+    uint32_t  h[HIST_BINS];
+    uint64_t  total = 0;
+
+    if ((level != VU_LEVEL_PEAK && level != VU_LEVEL_RMS) || count < 0 || channels < 0 ||
+        (count > 0 && (!percent || (channels > 0 && !to))))
+        return -EINVAL;
+
+    /* Channel 0 is read for the block count even when no percentiles are wanted. */
+    for (int c = 0; c < channels || c == 0; c++) {
+        unsigned int  seq;
+
+        /* peak_lock only keeps the arena alive; the worker updates histograms outside it. */
+        pthread_mutex_lock(&peak_lock);
+        if (!hist_peak || c >= (int)audio_channels) {
+            pthread_mutex_unlock(&peak_lock);
+            break;
+        }
+        const uint32_t *const  hist = ((level == VU_LEVEL_RMS) ? hist_rms : hist_peak) + (size_t)c * HIST_BINS;
+        do {
+            seq = atomic_load_explicit(&shared.hist_seq, memory_order_acquire);
+            if (seq & 1)
+                continue;
+            memcpy(h, hist, sizeof h);
+            atomic_thread_fence(memory_order_acquire);
+        } while ((seq & 1) || seq != atomic_load_explicit(&shared.hist_seq, memory_order_relaxed));
+        pthread_mutex_unlock(&peak_lock);
+
+        /* Every channel sees every block, so each histogram has the total. */
+        total = 0;
+        for (int b = 0; b < HIST_BINS; b++)
+            total += h[b];
+
+        for (int i = 0; i < count && c < channels; i++) {
+            const float  p = (percent[i] < 0.0f) ? 0.0f : (percent[i] < 100.0f) ? percent[i] : 100.0f;
+            uint64_t     want = (uint64_t)ceil((double)p * 0.01 * (double)total);
+            uint64_t     sum = 0;
+            int          b = 0;
+
+            if (want < 1)
+                want = 1;
+            while (b < HIST_BINS - 1 && (sum += h[b]) < want)
+                b++;
+
+            to[c * count + i] = (total > 0) ? level_centre(b) : 0.0f;
+        }
+    }
+
+    return (total < INT_MAX) ? (int)total : INT_MAX;
+}
+
+
+int vu_detect(vu_event_handler handler, void *context, float seconds)
+{
+    if (handler && !(seconds > 0.0f))
+        return -EINVAL;
+
+    pthread_mutex_lock(&peak_lock);
+    detect_handler = handler;
+    detect_context = context;
+    detect_seconds = seconds;
+    pthread_mutex_unlock(&peak_lock);
+    return 0;
+}
+
+
+int vu_batches(vu_batch_handler handler, void *context, int blocks)
+{
+    if (handler && blocks < 1)
+        return -EINVAL;
+
+    pthread_mutex_lock(&peak_lock);
+    batch_handler = handler;
+    batch_context = context;
+    batch_blocks = (handler) ? blocks : 0;
+    pthread_mutex_unlock(&peak_lock);
+    return 0;
+}
+
+
+int vu_groups(const struct vu_group *group, int groups)
+{
+    struct vu_group  *new_def = NULL;
+
+    if (groups < 0 || (groups > 0 && !group))
+        return -EINVAL;
+
+    if (groups > 0) {
+        for (int g = 0; g < groups; g++)
+            if (group[g].first < 0 || group[g].count < 1 ||
+                (group[g].type != VU_GROUP_MAX && group[g].type != VU_GROUP_POWER))
+                return -EINVAL;
+
+        new_def = malloc((size_t)groups * sizeof new_def[0]);
+        if (!new_def)
+            return -ENOMEM;
+        memcpy(new_def, group, (size_t)groups * sizeof new_def[0]);
+    }
+
+    pthread_mutex_lock(&peak_lock);
+    free(group_def);
+    group_def = new_def;
+    group_count = groups;
+    pthread_mutex_unlock(&peak_lock);
+    return 0;
+}
+
+
+/* Reserve bytes at *at, rounded up to whole cache lines; with base NULL, only count. */
+static void *carve(unsigned char *base, size_t *at, size_t bytes)
+{
+    void *const  ptr = (base) ? base + *at : NULL;
+    *at += (bytes + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    return ptr;
+}
+
+/* Lay out the per-stream arrays in the arena at base; with base NULL, only compute the region sizes. */
+static void layout(unsigned char *base, size_t channels, size_t samples, size_t pairs, size_t groups)
+{
+    size_t  at = 0;
+
+    audio_buffer = carve(base, &at, channels * samples * sizeof audio_buffer[0]);
+    audio_min    = carve(base, &at, channels * sizeof audio_min[0]);
+    audio_max    = carve(base, &at, channels * sizeof audio_max[0]);
+    audio_peak   = carve(base, &at, (channels + groups) * sizeof audio_peak[0]);
+    audio_power  = carve(base, &at, channels * sizeof audio_power[0]);
+    audio_group  = carve(base, &at, groups * sizeof audio_group[0]);
+    audio_pair   = carve(base, &at, pairs * sizeof audio_pair[0]);
+    audio_sum    = carve(base, &at, pairs * sizeof audio_sum[0]);
+    audio_phase  = carve(base, &at, pairs * sizeof audio_phase[0]);
+    audio_scope  = carve(base, &at, pairs * 2 * ((samples < VU_SCOPE_POINTS) ? samples : VU_SCOPE_POINTS) * sizeof audio_scope[0]);
+    audio_detect = carve(base, &at, (detect_handler) ? channels * sizeof audio_detect[0] : 0);
+    audio_batch_peak = carve(base, &at, (batch_handler) ? (size_t)batch_blocks * (channels + groups) * sizeof audio_batch_peak[0] : 0);
+    audio_batch_rms  = carve(base, &at, (batch_handler) ? (size_t)batch_blocks * channels * sizeof audio_batch_rms[0] : 0);
+    arena_producer = at;
+
+    peak_amplitude = carve(base, &at, (channels + groups) * sizeof peak_amplitude[0]);
+    phase          = carve(base, &at, pairs * sizeof phase[0]);
+    scope          = carve(base, &at, pairs * 2 * VU_SCOPE_POINTS * sizeof scope[0]);
+    hist_peak      = carve(base, &at, channels * HIST_BINS * sizeof hist_peak[0]);
+    hist_rms       = carve(base, &at, channels * HIST_BINS * sizeof hist_rms[0]);
+    arena_consumer = at - arena_producer;
+}
+
+
+int vu_memory(struct vu_memory *to)
+{
+    if (!to)
+        return -EINVAL;
+
+    pthread_mutex_lock(&peak_lock);
+    to->producer = arena_producer;
+    to->consumer = arena_consumer;
+    to->arena    = arena_producer + arena_consumer;
+    pthread_mutex_unlock(&peak_lock);
+    return 0;
+}
+
+
+static char *copy(const char *s)
+{
+    return (s) ? strdup(s) : NULL;
+}
+
 int vu_start(const char *server,
              const char *appname,
              const char *devname,
@@ -175,13 +1119,11 @@ int vu_start(const char *server,
              int         rate,
              int         samples)
 {
-    pa_sample_spec  samplespec;
-    pa_buffer_attr  bufferspec;
     pthread_attr_t  attrs;
     int             err;
 
     if (!appname || !*appname || !stream || !*stream ||
-        channels < 1  || channels > 128 || rate < 1 || rate > 1000000 || samples < 1 || samples > 1000000) {
+        channels < 1  || channels > MAX_CHANNELS || rate < 1 || rate > 1000000 || samples < 1 || samples > 1000000) {
         return -EINVAL;
     }
 
@@ -194,7 +1136,7 @@ int vu_start(const char *server,
         devname = NULL;
 
     /* If already running, stop. */
-    if (audio) {
+    if (link_loop) {
         vu_stop();
     }
 
@@ -202,74 +1144,121 @@ int vu_start(const char *server,
 
     pthread_mutex_lock(&peak_lock);
 
-    samplespec.format   = PA_SAMPLE_S32NE;
-    samplespec.rate     = rate;
-    samplespec.channels = channels;
+    for (int p = 0; p < pair_count; p++) {
+        if (pair_left[p] >= channels || pair_right[p] >= channels) {
+            pthread_mutex_unlock(&peak_lock);
+            return -EINVAL;
+        }
+    }
+    for (int g = 0; g < group_count; g++) {
+        if (group_def[g].first >= channels || group_def[g].count > channels - group_def[g].first) {
+            pthread_mutex_unlock(&peak_lock);
+            return -EINVAL;
+        }
+    }
+
+    audio_spec.format   = PA_SAMPLE_S32NE;
+    audio_spec.rate     = rate;
+    audio_spec.channels = channels;
 
-    bufferspec.maxlength = (uint32_t)(-1);
-    bufferspec.tlength   = (uint32_t)(-1);
-    bufferspec.prebuf    = (uint32_t)(-1);
-    bufferspec.minreq    = (uint32_t)(-1);
-    bufferspec.fragsize  = (uint32_t)channels * (uint32_t)samples * (uint32_t)sizeof audio_buffer[0];
+    audio_attr.maxlength = (uint32_t)(-1);
+    audio_attr.tlength   = (uint32_t)(-1);
+    audio_attr.prebuf    = (uint32_t)(-1);
+    audio_attr.minreq    = (uint32_t)(-1);
+    audio_attr.fragsize  = (uint32_t)channels * (uint32_t)samples * (uint32_t)sizeof audio_buffer[0];
 
-    err = PA_OK;
-    audio = pa_simple_new(server, appname, PA_STREAM_RECORD, devname, stream, &samplespec, NULL, &bufferspec, &err);
-    if (!audio) {
-        pthread_mutex_unlock(&peak_lock);
-        return err;
-    }
+    /* The worker connects to the server; nothing here waits for it. */
+    link_loop = pa_mainloop_new();
+    link_delay = LINK_DELAY_MIN;
+    shared.state = VU_CONNECTING;
+    shared.error = 0;
+    link_event = 0;
+    link_move = 0;
 
     /* Allocate memory for the various buffers. */
-    audio_buffer = calloc((size_t)channels * sizeof audio_buffer[0], (size_t)samples);
-    audio_min = malloc((size_t)channels * sizeof audio_min[0]);
-    audio_max = malloc((size_t)channels * sizeof audio_max[0]);
-    peak_amplitude = malloc((size_t)channels * sizeof peak_amplitude[0]);
-    if (!audio_buffer || !audio_min || !audio_max || !peak_amplitude) {
-        free(peak_amplitude);
-        free(audio_max);
-        free(audio_min);
-        free(audio_buffer);
-        pa_simple_free(audio);
-        audio = NULL;
-        audio_buffer = NULL;
-        audio_min = NULL;
-        audio_max = NULL;
-        peak_amplitude = NULL;
+    audio_server = copy(server);
+    audio_appname = copy(appname);
+    audio_devname = copy(devname);
+    audio_stream = copy(stream);
+    layout(NULL, channels, samples, pair_count, group_count);
+    if (posix_memalign((void **)&arena, CACHE_LINE, arena_producer + arena_consumer))
+        arena = NULL;
+    if (!link_loop || !audio_appname || !audio_stream || (server && !audio_server) || (devname && !audio_devname) ||
+        !arena) {
+        release();
+        shared.state = VU_STOPPED;
         pthread_mutex_unlock(&peak_lock);
         return -ENOMEM;
     }
 
-    for (int c = 0; c < channels; c++)
-        peak_amplitude[c] = 0.0f;
+    /* All zeros is the correct initial state for every array. */
+    memset(arena, 0, arena_producer + arena_consumer);
+    layout(arena, channels, samples, pair_count, group_count);
 
-    peak_available = 0;
+    if (group_count > 0)
+        memcpy(audio_group, group_def, (size_t)group_count * sizeof audio_group[0]);
+
+    shared.available = 0;
 
     audio_channels = channels;
     audio_samples  = samples;
+    audio_fill     = 0;
+
+    link_dropped = 0;
+    link_overruns = 0;
+    link_connects = 0;
+
+    atomic_fetch_add_explicit(&snapshot.seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(&snapshot.stats, 0, sizeof snapshot.stats);
+    memset(snapshot.peak, 0, sizeof snapshot.peak);
+    memset(snapshot.clipped, 0, sizeof snapshot.clipped);
+    snapshot.stats.channels = channels;
+    snapshot.stats.samples = samples;
+    snapshot.stats.rate = rate;
+    atomic_thread_fence(memory_order_release);
+    atomic_fetch_add_explicit(&snapshot.seq, 1, memory_order_relaxed);
+
+    for (int p = 0; p < pair_count; p++) {
+        audio_pair[p].left  = pair_left[p];
+        audio_pair[p].right = pair_right[p];
+    }
+    audio_pairs = pair_count;
+    audio_groups = group_count;
+    audio_decay = exp(-(double)samples / ((double)rate * PAIR_TIME));
+    scope_points = ((size_t)samples < VU_SCOPE_POINTS) ? (size_t)samples : VU_SCOPE_POINTS;
 
+    audio_handler = detect_handler;
+    audio_context = detect_context;
+    audio_block = (float)samples / (float)rate;
+    audio_rise = (float)pow(10.0, DETECT_RISE * audio_block / 10.0);
+    audio_wait = (uint32_t)ceil(detect_seconds / audio_block);
+    audio_clear = (uint32_t)ceil(DETECT_SOUND / audio_block);
+    if (audio_wait < 1)
+        audio_wait = 1;
+    if (audio_clear < 1)
+        audio_clear = 1;
+    for (int c = 0; c < channels && audio_detect; c++)
+        audio_detect[c].floor = 1.0f;
+
+    audio_batcher = batch_handler;
+    audio_batcher_context = batch_context;
+    audio_batch = (size_t)batch_blocks;
+    audio_batched = 0;
+
+    /* libpulse dispatches its callbacks on the worker stack, so give it some room. */
     pthread_attr_init(&attrs);
-    pthread_attr_setstacksize(&attrs, 2 * PTHREAD_STACK_MIN);
+    pthread_attr_setstacksize(&attrs, 8 * PTHREAD_STACK_MIN);
 
     err = pthread_create(&audio_thread, &attrs, worker, NULL);
+    pthread_attr_destroy(&attrs);
     if (err) {
-        pa_simple_free(audio);
-        free(peak_amplitude);
-        free(audio_max);
-        free(audio_min);
-        free(audio_buffer);
-        audio = NULL;
-        audio_buffer = NULL;
-        audio_min = NULL;
-        audio_max = NULL;
-        peak_amplitude = NULL;
-        audio_channels = 0;
-        audio_samples = 0;
+        release();
+        shared.state = VU_STOPPED;
         pthread_mutex_unlock(&peak_lock);
         return -err;
     }
 
-    pthread_attr_destroy(&attrs);
-
     pthread_mutex_unlock(&peak_lock);
 
     return 0;
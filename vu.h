@@ -1,9 +1,179 @@
 #ifndef   VU_H
 #define   VU_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * libvu ABI version; the major number is the shared library soname
+*/
+#define  VU_VERSION_MAJOR  1
+#define  VU_VERSION_MINOR  0
+
+/**
+ * Exported symbols; libvu is built with -fvisibility=hidden
+*/
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define  VU_API  __attribute__((visibility ("default")))
+#else
+#define  VU_API
+#endif
+
+/**
+ * Connection states reported by vu_state()
+*/
+enum {
+    VU_STOPPED      = 0,    /* Not started, or stopped */
+    VU_CONNECTING   = 1,    /* Connecting to the server */
+    VU_CONNECTED    = 2,    /* Recording from the source */
+    VU_DISCONNECTED = 3     /* Lost or failed connection; retrying */
+};
+
+/**
+ * Goniometer points per channel pair per update
+*/
+#ifndef  VU_SCOPE_POINTS
+#define  VU_SCOPE_POINTS  128
+#endif
+
+/**
+ * Phase measurements for a channel pair
+*/
+struct vu_phase {
+    float   correlation;    /* -1 (polarity swapped) to +1 (mono) */
+    float   mid;            /* Mean square of (L+R)/2, relative to full scale */
+    float   side;           /* Mean square of (L-R)/2, relative to full scale */
+};
+
+/**
+ * Select channel pairs for correlation and phase measurement
+ *
+ * Takes effect at the next vu_start().
+ *
+ * @param left      Array of left channel numbers
+ * @param right     Array of right channel numbers
+ * @param pairs     Number of pairs; zero to disable
+ * @return          Zero if success, negative errno if error.
+*/
+VU_API int  vu_pairs(const int *left, const int *right, int pairs);
+
+/**
+ * Channel group reductions
+*/
+enum {
+    VU_GROUP_MAX    = 0,    /* Largest peak in the group */
+    VU_GROUP_POWER  = 1     /* RMS amplitude of the mean block power of the channels */
+};
+
+/**
+ * Channel group, reported as a virtual channel
+*/
+struct vu_group {
+    int     first;          /* First channel in the group */
+    int     count;          /* Number of consecutive channels */
+    int     type;           /* VU_GROUP_MAX or VU_GROUP_POWER */
+};
+
+/**
+ * Define channel groups
+ *
+ * Takes effect at the next vu_start().  Group g is reported by
+ * vu_peak() as virtual channel channels + g, after the real ones.
+ *
+ * @param group     Array of group definitions
+ * @param groups    Number of groups; zero to disable
+ * @return          Zero if success, negative errno if error.
+*/
+VU_API int  vu_groups(const struct vu_group *group, int groups);
+
+/**
+ * Detector events
+*/
+enum {
+    VU_EVENT_SILENT     = 1,    /* No activity above the noise floor for too long */
+    VU_EVENT_SOUND      = 2,    /* Activity again after VU_EVENT_SILENT */
+    VU_EVENT_DC         = 3,    /* Channel stuck at a constant value */
+    VU_EVENT_DC_CLEAR   = 4     /* Channel no longer stuck */
+};
+
+struct vu_event {
+    int     type;           /* VU_EVENT_... */
+    int     channel;        /* Channel number */
+    float   seconds;        /* How long the condition has lasted */
+    float   level;          /* Block RMS amplitude, 0 to 1 */
+    float   floor;          /* Tracked noise floor RMS amplitude, 0 to 1 */
+    float   value;          /* Mean of the block's extreme samples, -1 to 1;
+                               the stuck value for VU_EVENT_DC */
+};
+
+/**
+ * Detector event handler
+ *
+ * Called from the capture thread; must return quickly and must not
+ * call back into the VU functions.
+*/
+typedef void (*vu_event_handler)(const struct vu_event *event, void *context);
+
+/**
+ * Enable the silent and stuck channel detector
+ *
+ * Takes effect at the next vu_start().  The detector tracks each
+ * channel's noise floor from block energies; a channel is active when
+ * its energy is well above the floor, or above -60 dBFS, so a steady
+ * signal is never reported silent.  Each condition must persist
+ * before it is reported, and again before it is cleared.
+ *
+ * @param handler   Function called for each event; NULL to disable
+ * @param context   Passed to handler as is
+ * @param seconds   How long a channel must be inactive before
+ *                  VU_EVENT_SILENT, or stuck before VU_EVENT_DC
+ * @return          Zero if success, negative errno if error.
+*/
+VU_API int  vu_detect(vu_event_handler handler, void *context, float seconds);
+
+/**
+ * A batch of consecutive per-block results
+ *
+ * The arrays belong to the capture thread and are only valid during
+ * the handler call.
+*/
+struct vu_batch {
+    uint64_t        first;      /* Sequence number of the first block */
+    int             blocks;     /* Number of blocks in the batch */
+    int             meters;     /* Peaks per block: channels, then groups */
+    int             channels;   /* RMS values per block */
+    const float    *peak;       /* peak[blocks][meters], 0 to 1: channel peaks, then group levels */
+    const float    *rms;        /* rms[blocks][channels], 0 to 1 */
+};
+
+/**
+ * Batch handler
+ *
+ * Called from the capture thread; must return quickly and must not
+ * call back into the VU functions.
+*/
+typedef void (*vu_batch_handler)(const struct vu_batch *batch, void *context);
+
+/**
+ * Deliver every block's results in batches, without locking
+ *
+ * Takes effect at the next vu_start().  Unlike vu_peak(), no block is
+ * merged or skipped; sequence numbers count blocks since vu_start().
+ * A partial batch is delivered when the stream is lost or stopped.
+ *
+ * @param handler   Function called for each batch; NULL to disable
+ * @param context   Passed to handler as is
+ * @param blocks    Blocks per batch
+ * @return          Zero if success, negative errno if error.
+*/
+VU_API int  vu_batches(vu_batch_handler handler, void *context, int blocks);
 
 /**
  * Initialize VU measurements
  *
+ * Returns immediately; the connection to the server is made in the
+ * background, and re-established with backoff if it is lost.
+ * If devname is NULL, the measurements follow the default source.
+ *
  * @param server    PulseAudio server; NULL for default
  * @param appname   Application name
  * @param devname   Source name; NULL for default
@@ -11,30 +181,30 @@
  * @param channels  Number of channels
  * @param rate      Samples per second per channel
  * @param samples   Samples per update
- * @return          Zero if success, nonzero if error.
+ * @return          Zero if success, negative errno if error.
 */
-int  vu_start(const char *server,
-              const char *appname,
-              const char *devname,
-              const char *stream,
-              int         channels,
-              int         rate,
-              int         samples);
+VU_API int  vu_start(const char *server,
+                     const char *appname,
+                     const char *devname,
+                     const char *stream,
+                     int         channels,
+                     int         rate,
+                     int         samples);
 
 /**
- * Convert vu_start() return value to a string
+ * Convert vu_start() return value or vu_state() error to a string
 */
-const char *vu_error(int);
+VU_API const char *vu_error(int);
 
 /**
  * Stop VU measurements
 */
-void  vu_stop(void);
+VU_API void  vu_stop(void);
 
 /**
  * Wait for the next VU update
 */
-void  vu_wait(void);
+VU_API void  vu_wait(void);
 
 /**
  * Get latest VU peaks per channel; thread-safe
@@ -43,13 +213,124 @@ void  vu_wait(void);
  * @param channels  Number of channels in peak array
  * @return          Zero if no new data available,
  *	            number of channels available if updated,
+ *                  including virtual channels for groups,
  *                  negative if an error occurred.
 */
-int  vu_peak(float *to, int channels);
+VU_API int  vu_peak(float *to, int channels);
 
 /**
  * Check if new VU peaks are available; thread-safe
 */
-int  vu_peak_available(void);
+VU_API int  vu_peak_available(void);
+
+/**
+ * Get latest phase measurements per channel pair; thread-safe
+ *
+ * @param to        Array of phase measurements to be populated
+ * @param pairs     Number of entries in the array
+ * @return          Number of channel pairs measured.
+*/
+VU_API int  vu_phase(struct vu_phase *to, int pairs);
+
+/**
+ * Get latest goniometer points of a channel pair; thread-safe
+ *
+ * Points are decimated to at most VU_SCOPE_POINTS per update.
+ *
+ * @param pair      Channel pair number
+ * @param xy        Array of 2*points floats to be populated with
+ *                  side (x) and mid (y) amplitudes, -1 to +1
+ * @param points    Number of points in the array
+ * @return          Number of points populated.
+*/
+VU_API int  vu_scope(int pair, float *xy, int points);
+
+/**
+ * Block levels kept in the session histograms
+*/
+enum {
+    VU_LEVEL_PEAK   = 0,    /* Block peak amplitude */
+    VU_LEVEL_RMS    = 1     /* Block RMS amplitude */
+};
+
+/**
+ * Get level percentiles since vu_start(); thread-safe
+ *
+ * Levels are histogrammed per block in four linear bins per octave,
+ * 1.16 to 1.94 dB wide, down to -120 dB; each percentile is reported
+ * as the geometric centre of its bin, so within 1 dB of the level.
+ *
+ * @param level     VU_LEVEL_PEAK or VU_LEVEL_RMS
+ * @param percent   Array of count percentiles, 0 to 100
+ * @param count     Number of percentiles
+ * @param to        Array of channels*count floats to be populated,
+ *                  to[channel][percentile], as amplitudes 0 to 1
+ * @param channels  Number of channels in the array
+ * @return          Number of blocks counted, zero if none yet,
+ *                  negative errno if an error occurred.
+*/
+VU_API int  vu_percentiles(int level, const float *percent, int count, float *to, int channels);
+
+/**
+ * Memory used by the running VU measurements
+*/
+struct vu_memory {
+    size_t  arena;          /* Bytes of per-stream state */
+    size_t  producer;       /* Of which only the capture thread touches */
+    size_t  consumer;       /* Of which readers copy from */
+};
+
+/**
+ * Report memory footprint; thread-safe
+ *
+ * @param to        Structure to be populated; all zeros if stopped
+ * @return          Zero if success, negative errno if error.
+*/
+VU_API int  vu_memory(struct vu_memory *to);
+
+/**
+ * Monitoring statistics since vu_start()
+*/
+struct vu_stats {
+    uint64_t    blocks;         /* Blocks processed */
+    uint64_t    block_nsec;     /* Total processing time of those blocks */
+    uint64_t    block_nsec_max; /* Longest processing time of a block */
+    uint64_t    dropped;        /* Frames lost to holes in the stream */
+    uint64_t    overruns;       /* Server-side buffer overruns */
+    uint64_t    connects;       /* Successful source connections */
+    uint64_t    reads;          /* vu_peak() calls that returned data */
+    uint64_t    lag;            /* Blocks processed since the last such call */
+    int         state;          /* As returned by vu_state() */
+    int         channels;       /* Number of real channels */
+    int         samples;        /* Samples per block */
+    int         rate;           /* Samples per second */
+};
+
+/**
+ * Get a statistics snapshot; thread-safe and lock-free
+ *
+ * Never takes the lock the capture thread uses, so it is safe to call
+ * from a monitoring thread at any rate.
+ *
+ * @param to        Statistics to be populated
+ * @param peak      Array of floats to be populated with the latest
+ *                  block peak per channel
+ * @param clipped   Array to be populated with the number of clipped
+ *                  blocks per channel
+ * @param channels  Number of channels in the peak and clipped arrays
+ * @return          Number of channels available,
+ *                  negative errno if an error occurred.
+*/
+VU_API int  vu_stats(struct vu_stats *to, float *peak, uint64_t *clipped, int channels);
+
+/**
+ * Get the current connection state; thread-safe
+ *
+ * @param err       If not NULL, set to the reason for the last
+ *                  disconnect, or zero
+ * @return          One of VU_STOPPED, VU_CONNECTING,
+ *                  VU_CONNECTED, or VU_DISCONNECTED.
+*/
+VU_API int  vu_state(int *err);
 
 #endif /* VU_H */